@@ -5,6 +5,15 @@ set(TIKTOKEN_PRIVATE_HEADERS
     tiktoken/include/sys_env.h
     tiktoken/include/utils.h
     tiktoken/include/core_bpe.h
+    tiktoken/include/bpe_vocab.h
+    tiktoken/include/vocab_file.h
+    tiktoken/include/embedded_encoding.h
+    tiktoken/include/piece_cache.h
+    tiktoken/include/pretokenizer.h
+    tiktoken/include/pattern_dfa.h
+    tiktoken/include/special_token_scanner.h
+    tiktoken/include/thread_pool.h
+    tiktoken/include/unicode_tables.h
     tiktoken/include/error_handler.h
     tiktoken/include/model.h
     tiktoken/include/registry.h
@@ -24,11 +33,36 @@ set(TIKTOKEN_COMMON_HEADERS
     common/Utf8String.h
     common/ScopeGuard.h
     common/pcre2cpp.h
+    common/MappedFile.h
 )
 
 set(TIKTOKEN_COMMON_SRCS
     common/Utf8String.cpp
     common/pcre2cpp.cpp
+    common/MappedFile.cpp
+)
+
+# embed_encoding tool, it only needs the vocabulary loader
+set(EMBED_ENCODING_SRCS
+    tools/embed_encoding.cpp
+    tiktoken/src/utils.cpp
+    tiktoken/src/bpe_vocab.cpp
+    tiktoken/src/vocab_file.cpp
+    tiktoken/src/embedded_encoding.cpp
+    tiktoken/src/thread_pool.cpp
+    tiktoken/src/registry.cpp
+    tiktoken/src/error_handler.cpp
+    tiktoken/src/sys_env.cpp
+    common/Utf8String.cpp
+    common/MappedFile.cpp
+)
+
+# regex_dfa tool, it only needs the split patterns and the unicode class table
+set(REGEX_DFA_SRCS
+    tools/regex_dfa.cpp
+    tiktoken/src/registry.cpp
+    tiktoken/src/error_handler.cpp
+    tiktoken/src/unicode_tables.cpp
 )
 
 set(TOKENTEST_COMMON_HEADERS
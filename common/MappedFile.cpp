@@ -0,0 +1,136 @@
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+#include <utility>
+#include "MappedFile.h"
+
+
+MappedFile::MappedFile(MappedFile&& mf) noexcept
+{
+    Swap(mf);
+}
+
+MappedFile::~MappedFile() noexcept
+{
+    Close();
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& mf) noexcept
+{
+    if (this != &mf)
+    {
+        Close();
+        Swap(mf);
+    }
+
+    return *this;
+}
+
+void MappedFile::Swap(MappedFile& mf) noexcept
+{
+    std::swap(m_data, mf.m_data);
+    std::swap(m_size, mf.m_size);
+#ifdef _WIN32
+    std::swap(m_file, mf.m_file);
+    std::swap(m_mapping, mf.m_mapping);
+#endif
+}
+
+#ifdef _WIN32
+
+bool MappedFile::Open(const std::string& pathname)
+{
+    Close();
+
+    HANDLE file = ::CreateFileA(pathname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!::GetFileSizeEx(file, &size) || (size.QuadPart == 0))
+    {
+        ::CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        ::CloseHandle(file);
+        return false;
+    }
+
+    void* data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr)
+    {
+        ::CloseHandle(mapping);
+        ::CloseHandle(file);
+        return false;
+    }
+
+    m_file = file;
+    m_mapping = mapping;
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<std::size_t>(size.QuadPart);
+
+    return true;
+}
+
+void MappedFile::Close() noexcept
+{
+    if (m_data != nullptr)
+        ::UnmapViewOfFile(m_data);
+    if (m_mapping != nullptr)
+        ::CloseHandle(m_mapping);
+    if (m_file != nullptr)
+        ::CloseHandle(m_file);
+
+    m_data = nullptr;
+    m_size = 0;
+    m_mapping = nullptr;
+    m_file = nullptr;
+}
+
+#else
+
+bool MappedFile::Open(const std::string& pathname)
+{
+    Close();
+
+    int fd = ::open(pathname.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if ((::fstat(fd, &st) != 0) || (st.st_size == 0))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); //the mapping keeps its own reference to the file
+    if (data == MAP_FAILED)
+        return false;
+
+    m_data = static_cast<const uint8_t*>(data);
+    m_size = static_cast<std::size_t>(st.st_size);
+
+    return true;
+}
+
+void MappedFile::Close() noexcept
+{
+    if (m_data != nullptr)
+        ::munmap(const_cast<uint8_t*>(m_data), m_size);
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <span>
+#include <cstdint>
+
+
+//read-only memory mapping of a whole file, pages are shared by all
+//processes mapping the same file
+class MappedFile final
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile(MappedFile&& mf) noexcept;
+    ~MappedFile() noexcept;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile& operator=(MappedFile&& mf) noexcept;
+
+    //map file, return false if the file can not be opened or mapped
+    bool Open(const std::string& pathname);
+    void Close() noexcept;
+
+    bool IsOpen() const { return m_data != nullptr; }
+    const uint8_t* Data() const { return m_data; }
+    std::size_t Size() const { return m_size; }
+    std::span<const uint8_t> Bytes() const { return { m_data, m_size }; }
+
+private:
+    void Swap(MappedFile& mf) noexcept;
+
+    const uint8_t* m_data = nullptr;
+    std::size_t m_size = 0;
+#ifdef _WIN32
+    void* m_file = nullptr;
+    void* m_mapping = nullptr;
+#endif
+};
@@ -1,161 +1,380 @@
 #include "iconv.h"
 #include "Utf8String.h"
 #include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <cctype>
+#include <cstdint>
 #include <algorithm>
 #include <iterator>
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <langinfo.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #include <emmintrin.h>
+    #define UTF8STRING_USE_SSE2
+#endif
+
+
+const uint32_t REPLACEMENT_CHAR = 0xFFFD;
+const wchar_t UTF16_BOM = 0xFEFF;
+//iconv output is written straight into the result string, grown by this much at least
+const std::size_t ICONV_MIN_GROW = 4096;
+
+//iconv descriptor opened once per thread and conversion, reset before every use
+class CIconv
+{
+public:
+    CIconv(const char* tocode, const char* fromcode) : m_cd(iconv_open(tocode, fromcode)) {}
+    CIconv(const CIconv&) = delete;
+    CIconv& operator=(const CIconv&) = delete;
+    ~CIconv()
+    {
+        if (IsValid())
+            iconv_close(m_cd);
+    }
 
+    bool IsValid() const { return m_cd != reinterpret_cast<iconv_t>(-1); }
+
+    //convert input and append it to output, stop at the first invalid or incomplete sequence
+    template<typename CT>
+    void Append(const char* input, std::size_t inRemain, std::basic_string<CT>& output)
+    {
+        if (!IsValid())
+            return;
+
+        iconv(m_cd, nullptr, nullptr, nullptr, nullptr);
+        std::string buffer;
+        buffer.resize(std::max(inRemain * 2, ICONV_MIN_GROW));
+        char* pSource = const_cast<char*>(input);
+        std::size_t written = 0;
+        while (inRemain > 0)
+        {
+            char* pTarget = buffer.data() + written;
+            std::size_t outRemain = buffer.size() - written;
+            std::size_t rtn = iconv(m_cd, &pSource, &inRemain, &pTarget, &outRemain);
+            written = pTarget - buffer.data();
+            if (rtn != static_cast<std::size_t>(-1))
+                break;
+            if (errno != E2BIG)
+                break;
+
+            buffer.resize(buffer.size() + std::max(inRemain * 2, ICONV_MIN_GROW));
+        }
+
+        written -= written % sizeof(CT);
+        output.append(reinterpret_cast<const CT*>(buffer.data()), written / sizeof(CT));
+    }
 
-const std::size_t LOCAL_BUF_SIZE = 64;
+private:
+    iconv_t m_cd;
+};
 
-template<typename CT = char>
-std::basic_string<CT> UTFStrFromLocalMBCS(const char *coder, const std::string& input)
+static CIconv& LocalToUtf8()
 {
-    std::basic_string<CT> output;
-    char szTmp[LOCAL_BUF_SIZE] = { 0 };
-    const char* pSource = input.c_str();
-    std::size_t inRemain = input.length();
+    static thread_local CIconv cd("UTF-8", "");
+    return cd;
+}
 
-    iconv_t cd = iconv_open(coder, "");
-    if (reinterpret_cast<unsigned long long>(cd) == 0xFFFFFFFF)
-        return output;
+static CIconv& Utf8ToLocal()
+{
+    static thread_local CIconv cd("", "UTF-8");
+    return cd;
+}
 
-    output.reserve(inRemain * 2); 
-    while (inRemain > 0)
+//locale charset is looked up once, like iconv's "" charset it is the one of the current C locale
+static bool IsUtf8Locale()
+{
+    static const bool utf8 = []()
     {
-        char* pTmp = szTmp;
-        std::size_t outRemain = LOCAL_BUF_SIZE;
-        std::size_t rtn = iconv(cd, (char**)&pSource, &inRemain, &pTmp, &outRemain);
-        if ((rtn == static_cast<std::size_t>(-1)) || (outRemain == LOCAL_BUF_SIZE))
-            break;
+#if defined(_WIN32)
+        return GetACP() == CP_UTF8;
+#else
+        std::string codeset = nl_langinfo(CODESET);
+        std::transform(codeset.begin(), codeset.end(), codeset.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        codeset.erase(std::remove(codeset.begin(), codeset.end(), '-'), codeset.end());
+        return codeset == "utf8";
+#endif
+    }();
+
+    return utf8;
+}
 
-        output.append((CT*)szTmp, (CT*)pTmp);
-        //memset(szTmp, 0, 64);
+//every locale charset iconv is used for keeps ASCII as it is
+static bool IsAscii(std::string_view input)
+{
+    const uint8_t* s = reinterpret_cast<const uint8_t*>(input.data());
+    std::size_t pos = 0;
+#ifdef UTF8STRING_USE_SSE2
+    for (; pos + 16 <= input.size(); pos += 16)
+    {
+        if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos))) != 0)
+            return false;
+    }
+#endif
+    for (; pos < input.size(); pos++)
+    {
+        if (s[pos] >= 0x80)
+            return false;
     }
-    iconv_close(cd);
 
-    return output;
+    return true;
 }
 
-template<typename CT = char>
-std::string LocalMBCSFromUTFStr(const char* coder, const std::basic_string<CT>& input)
+static void AppendUTF8CodePoint(uint32_t cp, std::string& output)
 {
-    char szTmp[LOCAL_BUF_SIZE] = { 0 };
-    const CT* pSource = input.c_str();
-    std::size_t inRemain = input.length() * sizeof(CT);
-    std::string output;
+    if (cp < 0x80)
+        output.push_back(static_cast<char>(cp));
+    else if (cp < 0x800)
+    {
+        output.push_back(static_cast<char>(0xC0 | (cp >> 6)));
+        output.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+    else if (cp < 0x10000)
+    {
+        output.push_back(static_cast<char>(0xE0 | (cp >> 12)));
+        output.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+    else
+    {
+        output.push_back(static_cast<char>(0xF0 | (cp >> 18)));
+        output.push_back(static_cast<char>(0x80 | ((cp >> 12) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | ((cp >> 6) & 0x3F)));
+        output.push_back(static_cast<char>(0x80 | (cp & 0x3F)));
+    }
+}
 
-    iconv_t cd = iconv_open("", coder);
-    if (reinterpret_cast<unsigned long long>(cd) == 0xFFFFFFFF)
-        return output;
+//length of the ASCII run at the start of input, 16 wchar_t at a time are narrowed into output
+static std::size_t AppendAsciiFromWide(std::wstring_view input, std::string& output)
+{
+    std::size_t pos = 0;
+#ifdef UTF8STRING_USE_SSE2
+    const wchar_t* s = input.data();
+    char block[16];
+    for (; pos + 16 <= input.size(); pos += 16)
+    {
+        __m128i bytes;
+        if constexpr (sizeof(wchar_t) == 2)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos + 8));
+            //any bit above the low 7 means no ASCII
+            if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16(static_cast<short>(0xFF80))), _mm_setzero_si128())) != 0xFFFF)
+                break;
+            bytes = _mm_packus_epi16(a, b);
+        }
+        else
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos + 4));
+            __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos + 8));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos + 12));
+            __m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, _mm_set1_epi32(~0x7F)), _mm_setzero_si128())) != 0xFFFF)
+                break;
+            bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(block), bytes);
+        output.append(block, 16);
+    }
+#endif
+
+    return pos;
+}
 
-    output.reserve(inRemain * 2);
-    while (inRemain > 0)
+//length of the ASCII run at the start of input, 16 bytes at a time are widened into output
+static std::size_t AppendAsciiToWide(std::string_view input, std::wstring& output)
+{
+    std::size_t pos = 0;
+#ifdef UTF8STRING_USE_SSE2
+    const char* s = input.data();
+    alignas(16) wchar_t block[16];
+    for (; pos + 16 <= input.size(); pos += 16)
     {
-        char* pTmp = szTmp;
-        std::size_t outRemain = LOCAL_BUF_SIZE;
-        std::size_t rtn = iconv(cd, (char**)&pSource, &inRemain, &pTmp, &outRemain);
-        if ((rtn == static_cast<std::size_t>(-1)) || (outRemain == LOCAL_BUF_SIZE))
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+        if (_mm_movemask_epi8(bytes) != 0)
             break;
 
-        output.append(szTmp, pTmp);
+        __m128i low = _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+        __m128i high = _mm_unpackhi_epi8(bytes, _mm_setzero_si128());
+        if constexpr (sizeof(wchar_t) == 2)
+        {
+            _mm_store_si128(reinterpret_cast<__m128i*>(block), low);
+            _mm_store_si128(reinterpret_cast<__m128i*>(block + 8), high);
+        }
+        else
+        {
+            _mm_store_si128(reinterpret_cast<__m128i*>(block), _mm_unpacklo_epi16(low, _mm_setzero_si128()));
+            _mm_store_si128(reinterpret_cast<__m128i*>(block + 4), _mm_unpackhi_epi16(low, _mm_setzero_si128()));
+            _mm_store_si128(reinterpret_cast<__m128i*>(block + 8), _mm_unpacklo_epi16(high, _mm_setzero_si128()));
+            _mm_store_si128(reinterpret_cast<__m128i*>(block + 12), _mm_unpackhi_epi16(high, _mm_setzero_si128()));
+        }
+        output.append(block, 16);
     }
-    iconv_close(cd);
+#endif
+    while ((pos < input.size()) && (static_cast<uint8_t>(input[pos]) < 0x80))
+        output.push_back(static_cast<wchar_t>(input[pos++]));
 
-    return output;
+    return pos;
 }
 
-std::wstring UTF16StrFromLocalMBCS(const std::string& input)
+void AppendUTF8FromWide(std::wstring_view input, std::string& output)
 {
-    auto rtn = UTFStrFromLocalMBCS<wchar_t>("UTF-16", input);
+    output.reserve(output.size() + input.size());
+    std::size_t i = 0;
+    while (i < input.size())
+    {
+        i += AppendAsciiFromWide(input.substr(i), output);
+        for (std::size_t end = std::min(input.size(), i + 16); i < end; i++)
+        {
+            uint32_t cp = static_cast<uint32_t>(input[i]);
+            if constexpr (sizeof(wchar_t) == 2)
+            {
+                cp &= 0xFFFF;
+                if ((cp >= 0xD800) && (cp <= 0xDBFF) && (i + 1 < input.size())
+                    && (input[i + 1] >= 0xDC00) && (input[i + 1] <= 0xDFFF))
+                {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (static_cast<uint32_t>(input[i + 1]) - 0xDC00);
+                    i++;
+                }
+            }
+            if (((cp >= 0xD800) && (cp <= 0xDFFF)) || (cp > 0x10FFFF))
+                cp = REPLACEMENT_CHAR;
+            AppendUTF8CodePoint(cp, output);
+        }
+    }
+}
 
-    return rtn;
+static void AppendWideFromUTF8(std::string_view input, std::wstring& output)
+{
+    static const uint32_t MIN_CODE_POINT[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+    output.reserve(output.size() + input.size());
+    std::size_t pos = 0;
+    while (pos < input.size())
+    {
+        pos += AppendAsciiToWide(input.substr(pos), output);
+        if (pos >= input.size())
+            break;
+
+        uint8_t c = static_cast<uint8_t>(input[pos]);
+        std::size_t length = ((c & 0xE0) == 0xC0) ? 2 : ((c & 0xF0) == 0xE0) ? 3 : ((c & 0xF8) == 0xF0) ? 4 : 0;
+        uint32_t cp = REPLACEMENT_CHAR;
+        std::size_t used = 1;
+        if ((length > 0) && (pos + length <= input.size()))
+        {
+            uint32_t value = c & (0x7Fu >> length);
+            std::size_t i = 1;
+            for (; (i < length) && ((static_cast<uint8_t>(input[pos + i]) & 0xC0) == 0x80); i++)
+                value = (value << 6) | (static_cast<uint8_t>(input[pos + i]) & 0x3Fu);
+            if ((i == length) && (value >= MIN_CODE_POINT[length]) && (value <= 0x10FFFF) && ((value < 0xD800) || (value > 0xDFFF)))
+            {
+                cp = value;
+                used = length;
+            }
+        }
+        pos += used;
+
+        if constexpr (sizeof(wchar_t) == 2)
+        {
+            if (cp >= 0x10000)
+            {
+                output.push_back(static_cast<wchar_t>(0xD800 + ((cp - 0x10000) >> 10)));
+                output.push_back(static_cast<wchar_t>(0xDC00 + ((cp - 0x10000) & 0x3FF)));
+                continue;
+            }
+        }
+        output.push_back(static_cast<wchar_t>(cp));
+    }
 }
 
-std::string LocalMBCSFromUTF16Str(const std::wstring& input)
+std::wstring WideFromUTF8(std::string_view input)
 {
-    std::string rtn = LocalMBCSFromUTFStr<wchar_t>("UTF-16", input);
+    std::wstring output;
+    AppendWideFromUTF8(input, output);
 
-    return rtn;
+    return output;
 }
 
 std::string UTF8StrFromLocalMBCS(const std::string& input)
 {
-    auto rtn = UTFStrFromLocalMBCS<char>("UTF-8", input);
+    if (IsUtf8Locale() || IsAscii(input))
+        return input;
 
-    return rtn;
+    std::string output;
+    LocalToUtf8().Append(input.data(), input.size(), output);
+
+    return output;
 }
 
 std::string LocalMBCSFromUTF8Str(const std::string& input)
 {
-    std::string rtn = LocalMBCSFromUTFStr<char>("UTF-8", input);
+    if (IsUtf8Locale() || IsAscii(input))
+        return input;
+
+    std::string output;
+    Utf8ToLocal().Append(input.data(), input.size(), output);
 
-    return rtn;
+    return output;
 }
 
-std::wstring UTF16LEStrFromLocalMBCS(const std::string& input)
+std::wstring UTF16StrFromLocalMBCS(const std::string& input)
 {
-    std::wstring rtn = UTFStrFromLocalMBCS<wchar_t>("UTF-16LE", input);
+    std::wstring output(1, UTF16_BOM);
+    if (IsUtf8Locale() || IsAscii(input))
+        AppendWideFromUTF8(input, output);
+    else
+        AppendWideFromUTF8(UTF8StrFromLocalMBCS(input), output);
 
-    return rtn;
+    return output;
 }
 
-std::string LocalMBCSFromUTF16LEStr(const std::wstring& input)
+std::string LocalMBCSFromUTF16Str(const std::wstring& input)
 {
-    std::string rtn = LocalMBCSFromUTFStr<wchar_t>("UTF-16LE", input);
+    std::wstring_view text = input;
+    if (!text.empty() && (text[0] == UTF16_BOM))
+        text.remove_prefix(1);
+
+    std::string utf8;
+    AppendUTF8FromWide(text, utf8);
 
-    return rtn;
+    if (IsUtf8Locale())
+        return utf8;
+
+    return LocalMBCSFromUTF8Str(utf8);
 }
 
-std::wstring UTF16LEStrFromUTF8(const std::string& input)
+std::wstring UTF16LEStrFromLocalMBCS(const std::string& input)
 {
-    std::wstring output;
-    char szTmp[LOCAL_BUF_SIZE] = { 0 };
-    const char* pSource = input.c_str();
-    std::size_t inRemain = input.length();
+    if (IsUtf8Locale() || IsAscii(input))
+        return WideFromUTF8(input);
 
-    iconv_t cd = iconv_open("UTF-16LE", "UTF-8");
-    if (reinterpret_cast<unsigned long long>(cd) == 0xFFFFFFFF)
-        return output;
+    return WideFromUTF8(UTF8StrFromLocalMBCS(input));
+}
 
-    output.reserve(inRemain * 2);
-    while (inRemain > 0)
-    {
-        char* pTmp = szTmp;
-        std::size_t outRemain = LOCAL_BUF_SIZE;
-        iconv(cd, (char**)&pSource, &inRemain, &pTmp, &outRemain);
-        if (outRemain == LOCAL_BUF_SIZE)
-            break;
+std::string LocalMBCSFromUTF16LEStr(const std::wstring& input)
+{
+    std::string utf8;
+    AppendUTF8FromWide(input, utf8);
 
-        output.append((wchar_t*)szTmp, (wchar_t*)pTmp);
-    }
-    iconv_close(cd);
+    if (IsUtf8Locale())
+        return utf8;
 
-    return output;
+    return LocalMBCSFromUTF8Str(utf8);
+}
+
+std::wstring UTF16LEStrFromUTF8(const std::string& input)
+{
+    return WideFromUTF8(input);
 }
 
 std::string UTF8FromUTF16LEStr(const std::wstring& input)
 {
-    char szTmp[LOCAL_BUF_SIZE] = { 0 };
-    const wchar_t* pSource = input.c_str();
-    std::size_t inRemain = input.length() * sizeof(char16_t);
     std::string output;
-
-    iconv_t cd = iconv_open("UTF-8", "UTF-16LE");
-    if (reinterpret_cast<unsigned long long>(cd) == 0xFFFFFFFF)
-        return output;
-
-    output.reserve(inRemain * 2);
-    while (inRemain > 0)
-    {
-        char* pTmp = szTmp;
-        std::size_t outRemain = LOCAL_BUF_SIZE;
-        iconv(cd, (char**)&pSource, &inRemain, &pTmp, &outRemain);
-        if (outRemain == LOCAL_BUF_SIZE)
-            break;
-
-        output.append(szTmp, pTmp);
-    }
-    iconv_close(cd);
+    AppendUTF8FromWide(input, output);
 
     return output;
 }
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 
+//wide strings are UTF-16 where wchar_t has 16 bits and UTF-32 otherwise. conversions between
+//UTF-8 and wide strings are done natively, iconv is only used for a local charset that is not
+//UTF-8, and not for ASCII text. the local charset is the one of the C locale at the first call
 
 //output utf-16 string with BOM header
 [[nodiscard]]
@@ -30,3 +34,11 @@ std::wstring UTF16LEStrFromUTF8(const std::string& input);
 
 [[nodiscard]]
 std::string UTF8FromUTF16LEStr(const std::wstring& input);
+
+//append the UTF-8 form of wide text (UTF-16 where wchar_t has 16 bits, UTF-32 otherwise) to
+//output without iconv. lone surrogates and code points above U+10FFFF become U+FFFD
+void AppendUTF8FromWide(std::wstring_view input, std::string& output);
+
+//wide text from UTF-8, invalid sequences become U+FFFD
+[[nodiscard]]
+std::wstring WideFromUTF8(std::string_view input);
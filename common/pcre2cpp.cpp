@@ -3,6 +3,17 @@
 
 namespace Pcre2
 {
+    CPcre2JitStack::CPcre2JitStack(std::size_t startSize, std::size_t maxSize, pcre2_general_context* gcontext)
+    {
+        m_stack = pcre2_jit_stack_create(startSize, maxSize, gcontext);
+        if (m_stack == nullptr)
+            throw CPcre2Exception(Pcre2MakeJitStackFail, "Fail to create JIT stack");
+    }
+    CPcre2JitStack::~CPcre2JitStack() noexcept
+    {
+        if (m_stack != nullptr)
+            pcre2_jit_stack_free(m_stack);
+    }
 
     CPcre2GeneralContext::CPcre2GeneralContext(void* memory_data)
     {
@@ -10,6 +10,7 @@
 #endif
 #include <vector>
 #include <optional>
+#include <utility>
 
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include "pcre2.h"
@@ -22,6 +23,10 @@ namespace Pcre2
     const uint32_t Pcre2CreateMatchDataFail = 203;
     const uint32_t Pcre2MakeCompileContextFail = 204;
     const uint32_t Pcre2MakeMatchContextFail = 205;
+    const uint32_t Pcre2MakeJitStackFail = 206;
+
+    //the only match options pcre2_jit_match() honours
+    const uint32_t Pcre2JitMatchOptions = PCRE2_NOTBOL | PCRE2_NOTEOL | PCRE2_NOTEMPTY | PCRE2_NOTEMPTY_ATSTART | PCRE2_PARTIAL_HARD | PCRE2_PARTIAL_SOFT;
 
     class CPcre2Exception : public std::runtime_error
     {
@@ -65,16 +70,40 @@ namespace Pcre2
     class CPcre2CompileContext;
     class CPcre2MatchContext;
 
+    //machine stack of JIT matching, one per thread, assigned to a match context
+    class CPcre2JitStack final
+    {
+    public:
+        CPcre2JitStack(std::size_t startSize = 32 * 1024, std::size_t maxSize = 1024 * 1024, pcre2_general_context* gcontext = nullptr);
+        CPcre2JitStack(const CPcre2JitStack& stack) = delete;
+        CPcre2JitStack(CPcre2JitStack&& stack) noexcept : m_stack(std::exchange(stack.m_stack, nullptr)) {}
+        ~CPcre2JitStack() noexcept;
+        CPcre2JitStack& operator=(const CPcre2JitStack& stack) = delete;
+        CPcre2JitStack& operator=(CPcre2JitStack&& stack) noexcept
+        {
+            std::swap(m_stack, stack.m_stack);
+            return *this;
+        }
+
+        operator pcre2_jit_stack* () const { return m_stack; }
+    private:
+        pcre2_jit_stack* m_stack;
+    };
+
     class CPcre2GeneralContext final
     {
     public:
         CPcre2GeneralContext() : m_context(nullptr) {}
         CPcre2GeneralContext(void* memory_data);
         CPcre2GeneralContext(const CPcre2GeneralContext& ctx);
-        CPcre2GeneralContext(CPcre2GeneralContext&& ctx) noexcept = default;
+        CPcre2GeneralContext(CPcre2GeneralContext&& ctx) noexcept : m_context(std::exchange(ctx.m_context, nullptr)) {}
         ~CPcre2GeneralContext() noexcept;
         CPcre2GeneralContext& operator=(const CPcre2GeneralContext& ctx);
-        CPcre2GeneralContext& operator=(CPcre2GeneralContext&& ctx) noexcept = default;
+        CPcre2GeneralContext& operator=(CPcre2GeneralContext&& ctx) noexcept
+        {
+            Swap(ctx);
+            return *this;
+        }
         CPcre2CompileContext CreateCompileContext();
         CPcre2MatchContext CreateMatchContext();
 
@@ -93,16 +122,26 @@ namespace Pcre2
         CPcre2MatchContext(bool bInit = false, pcre2_general_context* gcontext = nullptr);
         CPcre2MatchContext(pcre2_match_context* ctx);
         CPcre2MatchContext(const CPcre2MatchContext& ctx);
-        CPcre2MatchContext(CPcre2MatchContext&& ctx) noexcept = default;
+        CPcre2MatchContext(CPcre2MatchContext&& ctx) noexcept : m_context(std::exchange(ctx.m_context, nullptr)) {}
         ~CPcre2MatchContext() noexcept;
         CPcre2MatchContext& operator=(const CPcre2MatchContext& ctx);
-        CPcre2MatchContext& operator=(CPcre2MatchContext&& ctx) noexcept = default;
+        CPcre2MatchContext& operator=(CPcre2MatchContext&& ctx) noexcept
+        {
+            Swap(ctx);
+            return *this;
+        }
 
         int SetMatchLimit(uint32_t value) 
         {
             assert(m_context != nullptr);
             return pcre2_set_match_limit(m_context, value);
         }
+        //JIT matches with this context run on stack, which must outlive the context
+        void AssignJitStack(const CPcre2JitStack& stack)
+        {
+            assert(m_context != nullptr);
+            pcre2_jit_stack_assign(m_context, nullptr, stack);
+        }
         
         bool IsEmpty() const { return (m_context == nullptr); }
         operator pcre2_match_context* () const { return m_context; }
@@ -119,10 +158,14 @@ namespace Pcre2
         CPcre2CompileContext(pcre2_general_context* gcontext);
         CPcre2CompileContext(pcre2_compile_context* ctx);
         CPcre2CompileContext(const CPcre2CompileContext& ctx);
-        CPcre2CompileContext(CPcre2CompileContext&& ctx) noexcept = default;
+        CPcre2CompileContext(CPcre2CompileContext&& ctx) noexcept : m_context(std::exchange(ctx.m_context, nullptr)) {}
         ~CPcre2CompileContext() noexcept;
         CPcre2CompileContext& operator=(const CPcre2CompileContext& ctx);
-        CPcre2CompileContext& operator=(CPcre2CompileContext&& ctx) noexcept = default;
+        CPcre2CompileContext& operator=(CPcre2CompileContext&& ctx) noexcept
+        {
+            Swap(ctx);
+            return *this;
+        }
 
         /*
           PCRE2_EXTRA_ALLOW_LOOKAROUND_BSK     Allow \K in lookarounds PCRE2_EXTRA_ALLOW_SURROGATE_ESCAPES  Allow \x{df800} to \x{dfff}
@@ -225,9 +268,13 @@ namespace Pcre2
         CPcre2MatchData(pcre2_match_data* md) : m_matchData(md) {}
         CPcre2MatchData(uint32_t ovecsize, std::optional<CPcre2GeneralContext> ctx = std::nullopt);
         CPcre2MatchData(const CPcre2MatchData& md) = delete;
-        CPcre2MatchData(CPcre2MatchData&& md) noexcept = default;
+        CPcre2MatchData(CPcre2MatchData&& md) noexcept : m_matchData(std::exchange(md.m_matchData, nullptr)) {}
         CPcre2MatchData& operator=(const CPcre2MatchData& md) = delete;
-        CPcre2MatchData& operator=(CPcre2MatchData&& md) noexcept = default;
+        CPcre2MatchData& operator=(CPcre2MatchData&& md) noexcept
+        {
+            std::swap(m_matchData, md.m_matchData);
+            return *this;
+        }
         ~CPcre2MatchData() noexcept;
 
         CPcre2OVector GetOVectorPointer()
@@ -253,6 +300,8 @@ namespace Pcre2
         pcre2_match_data* m_matchData;
     };
 
+    //compiled pattern is read only after Compile(), const members can be called
+    //from many threads as long as each thread uses its own CPcre2MatchData
     template<typename Ch = char8_t> //default for utf-8
     class CPcre2Regex
     {
@@ -261,7 +310,7 @@ namespace Pcre2
         CPcre2Regex() : m_code(nullptr) {}
         CPcre2Regex(pcre2_code* code) : m_code(code) {}
         CPcre2Regex(const CPcre2Regex& re) = delete;
-        CPcre2Regex(CPcre2Regex&& re) noexcept = default;
+        CPcre2Regex(CPcre2Regex&& re) noexcept : m_code(std::exchange(re.m_code, nullptr)), m_jit(std::exchange(re.m_jit, false)) {}
         CPcre2Regex(const std::string& pattern,
                     std::size_t option = PCRE2_UTF|PCRE2_UCP, //default options for unicode string
                     std::optional<CPcre2CompileContext> ctx = std::nullopt)
@@ -269,8 +318,19 @@ namespace Pcre2
             Compile(pattern, option, ctx);
         }
 
+        ~CPcre2Regex() noexcept
+        {
+            if (m_code != nullptr)
+                pcre2_code_free(m_code);
+        }
+
         CPcre2Regex& operator=(const CPcre2Regex& re) = delete;
-        CPcre2Regex& operator=(CPcre2Regex&& re) noexcept = default;
+        CPcre2Regex& operator=(CPcre2Regex&& re) noexcept
+        {
+            std::swap(m_code, re.m_code);
+            std::swap(m_jit, re.m_jit);
+            return *this;
+        }
 
         void Compile(const std::string& pattern,
             std::size_t option = PCRE2_UTF|PCRE2_UCP,  //PCRE2_ZERO_TERMINATED
@@ -285,10 +345,25 @@ namespace Pcre2
             if (code == nullptr)
                 throw CPcre2Exception(err_code, err_offset);
 
+            if (m_code != nullptr)
+                pcre2_code_free(m_code);
             m_code = code;
+            m_jit = false;
+        }
+
+        //opt-in JIT compilation of the compiled pattern, false if JIT is not available
+        //(library built without it, unsupported CPU), matching is interpreted then
+        bool JitCompile(uint32_t options = PCRE2_JIT_COMPLETE)
+        {
+            assert(m_code != nullptr);
+
+            m_jit = (pcre2_jit_compile(m_code, options) == 0);
+            return m_jit;
         }
 
-        std::optional<Pcre2Match> Match(const StringType& text, PCRE2_SIZE startoffset = 0, uint32_t options = 0)
+        bool IsJitCompiled() const { return m_jit; }
+
+        std::optional<Pcre2Match> Match(const StringType& text, PCRE2_SIZE startoffset = 0, uint32_t options = 0) const
         {
             assert(m_code != nullptr);
 
@@ -305,7 +380,7 @@ namespace Pcre2
             return std::nullopt;
         }
 
-        std::vector<StringType> Matchs(const StringType& text, uint32_t options = 0, std::optional<CPcre2MatchContext> ctx = std::nullopt)
+        std::vector<StringType> Matchs(const StringType& text, uint32_t options = 0, std::optional<CPcre2MatchContext> ctx = std::nullopt) const
         {
             assert(m_code != nullptr);
 
@@ -330,17 +405,32 @@ namespace Pcre2
             return matchs;
         }
 
-        int Match(const StringType& text, PCRE2_SIZE startoffset, CPcre2MatchData& match_data, uint32_t options = 0, std::optional<CPcre2MatchContext> ctx = std::nullopt)
+        int Match(std::basic_string_view<Ch> text, PCRE2_SIZE startoffset, CPcre2MatchData& match_data, uint32_t options = 0, std::optional<CPcre2MatchContext> ctx = std::nullopt) const
         {
             assert(m_code != nullptr);
 
-            PCRE2_SPTR subject = (PCRE2_SPTR)text.c_str();
+            PCRE2_SPTR subject = (PCRE2_SPTR)text.data();
             PCRE2_SIZE length = text.length();
 
             return pcre2_match(m_code, subject, length, startoffset, options, match_data, ctx.value_or(s_emptyMatchCtx));
         }
 
-        CPcre2MatchData CreateMatchDataFromPattern(std::optional<CPcre2GeneralContext> ctx = std::nullopt)
+        //Match() without context copies. a JIT compiled pattern matched with PCRE2_NO_UTF_CHECK
+        //(the caller validated the subject) goes straight to pcre2_jit_match(), which skips
+        //the option and UTF checks of pcre2_match()
+        int FastMatch(std::basic_string_view<Ch> text, PCRE2_SIZE startoffset, CPcre2MatchData& match_data, uint32_t options = 0, pcre2_match_context* ctx = nullptr) const
+        {
+            assert(m_code != nullptr);
+
+            PCRE2_SPTR subject = (PCRE2_SPTR)text.data();
+            PCRE2_SIZE length = text.length();
+            if (m_jit && (options & PCRE2_NO_UTF_CHECK) && !(options & ~(Pcre2JitMatchOptions | PCRE2_NO_UTF_CHECK)))
+                return pcre2_jit_match(m_code, subject, length, startoffset, options & Pcre2JitMatchOptions, match_data, ctx);
+
+            return pcre2_match(m_code, subject, length, startoffset, options, match_data, ctx);
+        }
+
+        CPcre2MatchData CreateMatchDataFromPattern(std::optional<CPcre2GeneralContext> ctx = std::nullopt) const
         {
             assert(m_code != nullptr);
 
@@ -350,7 +440,8 @@ namespace Pcre2
         }
 
     private:
-        pcre2_code* m_code;
+        pcre2_code* m_code = nullptr;
+        bool m_jit = false;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <optional>
+#include <cstring>
+#include "global_define.h"
+
+namespace TiktokenCpp
+{
+    //one slot of the open-addressing index.
+    //tokens of 8 bytes or fewer are packed into key and compared as integers,
+    //for longer tokens key is the offset of the token bytes in the arena.
+    struct VocabSlot
+    {
+        uint64_t key;
+        uint32_t rank;
+        uint32_t length; //0 means empty slot
+    };
+
+    constexpr std::size_t PACKED_TOKEN_MAX = sizeof(uint64_t);
+
+    inline uint64_t PackTokenBytes(ByteSpan bytes)
+    {
+        uint64_t key = 0;
+        std::memcpy(&key, bytes.data(), bytes.size());
+        return key;
+    }
+
+    //murmur3 finalizer
+    inline uint64_t VocabHashMix(uint64_t x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    inline uint64_t VocabHashPacked(uint64_t key, std::size_t length)
+    {
+        return VocabHashMix(key + length * 0x9e3779b97f4a7c15ULL);
+    }
+
+    inline uint64_t VocabHashBytes(ByteSpan bytes)
+    {
+        uint64_t hash = bytes.size() * 0x9e3779b97f4a7c15ULL;
+        std::size_t i = 0;
+        for (; i + PACKED_TOKEN_MAX <= bytes.size(); i += PACKED_TOKEN_MAX)
+            hash = VocabHashMix(hash ^ PackTokenBytes(bytes.subspan(i, PACKED_TOKEN_MAX)));
+        if (i < bytes.size())
+            hash = VocabHashMix(hash ^ PackTokenBytes(bytes.subspan(i)));
+
+        return hash;
+    }
+
+    //map 32 bits of a hash onto [0, n) without division
+    inline std::size_t VocabHashRange(uint64_t hash, std::size_t n)
+    {
+        return static_cast<std::size_t>(((hash & 0xFFFFFFFFULL) * n) >> 32);
+    }
+
+    //token bytes <-> rank table, all token bytes live in one arena ordered by rank
+    class BpeVocab final
+    {
+    public:
+        BpeVocab() = default;
+        BpeVocab(const BpeVocab& vocab) = delete;
+        BpeVocab(BpeVocab&& vocab) noexcept = default;
+        BpeVocab& operator=(const BpeVocab& vocab) = delete;
+        BpeVocab& operator=(BpeVocab&& vocab) noexcept = default;
+
+        //building: Add() all tokens, then Build() once
+        void Reserve(std::size_t count, std::size_t bytes);
+        void Add(ByteSpan bytes, uint32_t rank);
+        void Build();
+        //take rank ordered tables built elsewhere (rank -> [offsets[rank], offsets[rank + 1]) of arena,
+        //empty ranges are rank gaps) and build the index. throw std::runtime_error if tables are inconsistent
+        void Assign(std::vector<uint8_t> arena, std::vector<uint32_t> offsets);
+        //replace the index with a minimal perfect hash: one slot per token and a displacement per
+        //bucket of about 4 tokens, every lookup reads exactly one slot. slow to build, meant for
+        //tables generated at build time. throw std::runtime_error if no displacement is found
+        void BuildPerfectIndex();
+
+        //use prebuilt tables living in external memory (e.g. a mapped file),
+        //owner keeps that memory alive. throw std::runtime_error if tables are inconsistent
+        //slots are a minimal perfect hash index when displacements is not empty
+        void Attach(ByteSpan arena, std::span<const uint32_t> offsets, std::span<const VocabSlot> slots,
+                    std::size_t count, std::shared_ptr<const void> owner, std::span<const uint32_t> displacements = {});
+
+        //raw tables, for serialization
+        ByteSpan ArenaBytes() const { return m_arena; }
+        std::span<const uint32_t> RankOffsets() const { return m_offsets; }
+        std::span<const VocabSlot> IndexSlots() const { return m_slots; }
+        std::span<const uint32_t> Displacements() const { return m_displacements; } //empty for linear probing index
+
+        std::optional<uint32_t> Find(ByteSpan bytes) const
+        {
+            const std::size_t length = bytes.size();
+            if (m_slots.empty() || (length == 0))
+                return std::nullopt;
+
+            if (length <= PACKED_TOKEN_MAX)
+            {
+                uint64_t key = PackTokenBytes(bytes);
+                uint64_t hash = VocabHashPacked(key, length);
+                if (!m_displacements.empty())
+                {
+                    const VocabSlot& slot = m_slots[PerfectSlot(hash)];
+                    if ((slot.length == length) && (slot.key == key))
+                        return slot.rank;
+                    return std::nullopt;
+                }
+
+                for (std::size_t i = hash & m_mask; m_slots[i].length != 0; i = (i + 1) & m_mask)
+                {
+                    if ((m_slots[i].length == length) && (m_slots[i].key == key))
+                        return m_slots[i].rank;
+                }
+            }
+            else
+            {
+                uint64_t hash = VocabHashBytes(bytes);
+                if (!m_displacements.empty())
+                {
+                    const VocabSlot& slot = m_slots[PerfectSlot(hash)];
+                    if ((slot.length == length) && (std::memcmp(m_arena.data() + slot.key, bytes.data(), length) == 0))
+                        return slot.rank;
+                    return std::nullopt;
+                }
+
+                for (std::size_t i = hash & m_mask; m_slots[i].length != 0; i = (i + 1) & m_mask)
+                {
+                    if ((m_slots[i].length == length) && (std::memcmp(m_arena.data() + m_slots[i].key, bytes.data(), length) == 0))
+                        return m_slots[i].rank;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+        //bytes of a token, empty if the rank is not in the vocabulary
+        ByteSpan TokenBytes(uint32_t rank) const
+        {
+            if (rank + 1 >= m_offsets.size())
+                return {};
+
+            return ByteSpan(m_arena.data() + m_offsets[rank], m_offsets[rank + 1] - m_offsets[rank]);
+        }
+
+        std::size_t Size() const { return m_count; }
+        //rank table size, equal to Size() when ranks are dense
+        std::size_t RankCount() const { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+        std::size_t MemoryUsage() const;
+
+    private:
+        struct PendingToken
+        {
+            uint32_t rank;
+            uint32_t offset;
+            uint32_t length;
+        };
+
+        //high half of the hash picks the bucket, the low half mixed with its displacement picks the slot
+        std::size_t PerfectSlot(uint64_t hash) const
+        {
+            uint32_t displacement = m_displacements[VocabHashRange(hash >> 32, m_displacements.size())];
+            return VocabHashRange(VocabHashMix(hash + displacement), m_slots.size());
+        }
+
+        //views of the tables, they point to the owned storage below or to attached memory
+        ByteSpan m_arena;
+        std::span<const uint32_t> m_offsets; //rank -> [m_offsets[rank], m_offsets[rank + 1]) of m_arena
+        std::span<const VocabSlot> m_slots;
+        std::span<const uint32_t> m_displacements;
+        std::size_t m_mask = 0;
+        std::size_t m_count = 0;
+
+        std::vector<uint8_t> m_arenaStorage;
+        std::vector<uint32_t> m_offsetsStorage;
+        std::vector<VocabSlot> m_slotsStorage;
+        std::vector<uint32_t> m_displacementsStorage;
+        std::shared_ptr<const void> m_owner;
+        std::vector<PendingToken> m_pending;
+    };
+}
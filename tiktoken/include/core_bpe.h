@@ -4,38 +4,127 @@
 #include <optional>
 //#include <unordered_set>
 #include "global_define.h"
+#include "bpe_vocab.h"
+#include "piece_cache.h"
+#include "pretokenizer.h"
+#include "special_token_scanner.h"
 #include "pcre2cpp.h"
 
 namespace TiktokenCpp
 {
+    //pieces at least this long are merged with the heap based algorithm
+    constexpr std::size_t LARGE_PIECE_THRESHOLD = 256;
+
+    //CoreBpe is fully built by its constructor and never modified afterwards,
+    //all members are const and per-call scratch state is kept per thread,
+    //so one instance can be shared by any number of threads without locking.
+    //the only shared mutable state is the piece cache, which locks internally.
     class CoreBpe final
     {
     public:
-        CoreBpe(std::unique_ptr<encode_dict> encoder, const StrViewToInt& specialTokensEncoder, const std::string_view& pattern);
-        std::string TokenToSymbol(uint32_t token);
+        CoreBpe(std::unique_ptr<BpeVocab> encoder, const StrViewToInt& specialTokensEncoder, const std::string_view& pattern);
+        std::string TokenToSymbol(uint32_t token) const;
+
+        std::vector<uint32_t> EncodeOrdinaryNative(std::string_view utf8Text) const;
+        //append the tokens to a caller's vector
+        void EncodeOrdinaryInto(std::string_view utf8Text, std::vector<uint32_t>& tokens) const;
+        //wide text (UTF-16 or UTF-32, as wchar_t is) is transcoded chunk by chunk while it is
+        //encoded, no UTF-8 copy of the whole text is made. invalid code units become U+FFFD
+        std::vector<uint32_t> EncodeOrdinaryNative(const std::wstring& wideText) const;
+        //same tokens as EncodeOrdinaryNative, parts of about chunkBytes (0 for automatic) are cut
+        //at FindResyncPoint() and encoded on the shared thread pool. serial if the split pattern
+        //has no proven resync points or the text is not valid UTF-8
+        std::vector<uint32_t> EncodeOrdinaryParallel(std::string_view utf8Text, std::size_t chunkBytes = 0) const;
+        //tokens of EncodeOrdinaryNative up to the first piece that does not fit into maxTokens,
+        //no piece after it is split or merged. text with invalid UTF-8 is encoded in full first
+        TokenPrefix EncodeUpTo(std::string_view utf8Text, std::size_t maxTokens) const;
+
+        //allowedSpecial is a mask of special token indexes of GetSpecialScanner(), empty for none
+        std::vector<uint32_t> EncodeNative(std::string_view utf8Text, const std::vector<bool>& allowedSpecial) const;
+        void EncodeNativeInto(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, std::vector<uint32_t>& tokens) const;
+        //tokens are given to sink while the text is encoded, in chunks of at least chunkTokens
+        //tokens. only the last chunk may be shorter
+        void EncodeNativeChunked(std::string_view utf8Text, const std::vector<bool>& allowedSpecial,
+                                 std::size_t chunkTokens, const TokenSink& sink) const;
+        //write the tokens into buffer, return the number of tokens of the text. tokens past the
+        //end of buffer are only counted
+        std::size_t EncodeNativeToSpan(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, std::span<uint32_t> buffer) const;
+        //throw std::runtime_error if a token of the disallowedSpecial mask is found in wideText
+        std::vector<uint32_t> EncodeNative(const std::wstring& wideText, const std::vector<bool>& allowedSpecial,
+                                          const std::vector<bool>& disallowedSpecial = {}) const;
+
+        //number of tokens EncodeOrdinaryNative / EncodeNative give, without storing them
+        std::size_t CountOrdinaryNative(std::string_view utf8Text) const;
+        std::size_t CountNative(std::string_view utf8Text, const std::vector<bool>& allowedSpecial) const;
+
+        //tokens of EncodeOrdinaryNative / EncodeNative with their byte offsets, and UTF-16 offsets
+        //if withUtf16 is set. offsets are summed up part by part while the text is encoded
+        TokenOffsets EncodeOrdinaryWithOffsets(std::string_view utf8Text, bool withUtf16 = false) const;
+        TokenOffsets EncodeWithOffsets(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, bool withUtf16 = false) const;
+
+        const SpecialTokenScanner& GetSpecialScanner() const { return m_specialScanner; }
+
+        std::vector<std::string> DecodeNative(const std::vector<uint32_t>& tokens) const;
+        //bytes of a token (ordinary or special), empty for unknown tokens
+        ByteSpan TokenBytes(uint32_t token) const;
+        //exact byte length of the decoded tokens
+        std::size_t DecodedLength(std::span<const uint32_t> tokens) const;
+        //decode into caller's buffer, return bytes written; throw std::length_error if buffer is too small
+        std::size_t DecodeInto(std::span<const uint32_t> tokens, std::span<char> buffer) const;
+        //decode and append to out
+        void DecodeBytes(std::span<const uint32_t> tokens, std::string& out) const;
 
-        std::vector<uint32_t> EncodeOrdinaryNative(const std::string& utf8Text);
-        std::vector<uint32_t> EncodeOrdinaryNative(const std::wstring& utf16Text);
+        //byte pair merge of one piece with the linear scan, or with the heap if largeMerge is set,
+        //whatever its length. tests hold the two against each other
+        std::vector<uint32_t> MergePiece(ByteSpan piece, bool largeMerge) const;
 
-        std::vector<uint32_t> EncodeNative(const std::string& utf8Text, const Utf8StringSet& allowedSpecial);
-        std::vector<uint32_t> EncodeNative(const std::wstring& utf16Text, const Utf8StringSet& allowedSpecial);
+        //approximate heap memory held by this object
+        std::size_t MemoryUsage() const;
 
-        std::vector<std::string> DecodeNative(const std::vector<uint32_t>& tokens);
+        PieceCacheStats GetPieceCacheStats() const { return m_pieceCache.GetStats(); }
+        void SetPieceCacheLimit(std::size_t bytes) const { m_pieceCache.SetLimit(bytes); }
 
     protected:
-        std::unique_ptr<decode_dict> InitDecodeDict();
-        std::vector<std::string> Utf8WordsSpliter(const std::string& utf8Text);
-        //std::vector<std::u8string> Utf16WordsSpliter(const std::u16string& utf16Text);
-        std::vector<uint32_t> BytePairMerge(const std::vector<uint8_t>& piece, std::function<uint32_t(std::pair<size_t, size_t>)> f);
-        std::vector<uint32_t> BytePairEncode(const std::vector<uint8_t>& piece);
+        //calls onPiece(ByteSpan) for every piece of the split pattern, in order, without copying
+        //them. an onPiece returning bool stops the split with false. utf8Text must be valid UTF-8
+        template<typename PieceFn>
+        void ForEachPiece(std::string_view utf8Text, PieceFn&& onPiece) const;
+        //calls onPart(std::string_view, bool validUtf8) for the text between allowed special tokens
+        //and onSpecial(const SpecialTokenMatch&) for every allowed special token, in order
+        template<typename PartFn, typename SpecialFn>
+        void ForEachPart(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, PartFn&& onPart, SpecialFn&& onSpecial) const;
+        //append tokens of ordinary text, text with invalid UTF-8 is encoded without loss as
+        //tiktoken encodes bytes. validUtf8 is the result of IsValidUtf8(text)
+        void EncodeBytes(std::string_view text, bool validUtf8, std::vector<uint32_t>& tokens) const;
+        //the invalid part of EncodeBytes: tokens from lastPiece on are merged again with the bytes
+        //of text from validLength on. return the first token of that merge
+        std::size_t EncodeInvalidTail(std::string_view text, std::size_t validLength, std::size_t firstToken,
+                                      std::size_t lastPiece, std::vector<uint32_t>& tokens) const;
+        void EncodeWide(std::wstring_view wideText, const std::vector<bool>& allowedSpecial,
+                        const std::vector<bool>& disallowedSpecial, std::vector<uint32_t>& tokens) const;
+        //ordinary token of only spaces, tabs and newlines
+        bool IsAllSpace(uint32_t token) const;
+        //merge results are appended to out, pieces of LARGE_PIECE_THRESHOLD bytes or more use the heap
+        void BytePairMerge(ByteSpan piece, std::function<uint32_t(std::pair<size_t, size_t>)> f, std::vector<uint32_t>& out) const;
+        void BytePairMergeSmall(ByteSpan piece, std::function<uint32_t(std::pair<size_t, size_t>)> f, std::vector<uint32_t>& out) const;
+        void BytePairMergeLarge(ByteSpan piece, std::function<uint32_t(std::pair<size_t, size_t>)> f, std::vector<uint32_t>& out) const;
+        void BytePairEncode(ByteSpan piece, std::vector<uint32_t>& out) const;
+        //append tokens of one pre-tokenized piece: vocabulary hit, cache hit or byte pair merge
+        void EncodePiece(ByteSpan piece, std::vector<uint32_t>& tokens) const;
+        //tokens of EncodeBytes / EncodePiece, only merges that miss the piece cache store tokens
+        std::size_t CountBytes(std::string_view text, bool validUtf8) const;
+        std::size_t CountPiece(ByteSpan piece) const;
+        uint32_t RankOf(ByteSpan bytes) const;
 
     private:
-        std::unique_ptr<encode_dict> m_encoder;
-        std::unique_ptr<decode_dict> m_decoder;
+        std::unique_ptr<const BpeVocab> m_encoder;
         Utf8StrToInt m_specialTokensEncoder;
         decode_dict m_specialTokensDecoder;
+        SpecialTokenScanner m_specialScanner;
+        std::unique_ptr<const Pretokenizer> m_pretokenizer; //nullptr if the pattern has no hand-written or generated scanner
+        bool m_resyncSplit; //HasResyncPoints(pattern)
         Pcre2::CPcre2Regex<char> m_Regex;
-        Pcre2::CPcre2Regex<char> m_SpecialRegex;
+        mutable PieceCache m_pieceCache;
     };
 }
 
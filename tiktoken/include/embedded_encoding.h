@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include "global_define.h"
+#include "bpe_vocab.h"
+
+namespace TiktokenCpp
+{
+    //vocabulary tables compiled into the library (cmake option EMBED_ENCODING_FILES),
+    //generated at build time by tools/embed_encoding.cpp
+    struct EmbeddedEncoding
+    {
+        const char* name;
+        const uint8_t* arena;
+        std::size_t arenaSize;
+        const uint32_t* offsets; //rankCount + 1
+        std::size_t rankCount;
+        const VocabSlot* slots; //minimal perfect hash index, one slot per token
+        std::size_t tokenCount;
+        const uint32_t* displacements;
+        std::size_t displacementCount;
+    };
+
+    //nullptr if the encoding is not embedded
+    const EmbeddedEncoding* FindEmbeddedEncoding(const std::string_view& name);
+
+    //vocabulary using the embedded tables in place, nothing is copied or parsed
+    std::unique_ptr<BpeVocab> LoadEmbeddedVocab(const EmbeddedEncoding& encoding);
+}
@@ -6,19 +6,6 @@
 namespace TiktokenCpp 
 {
     void ThrowGeneralException(const std::string& reason, const std::string_view& param);
-
-    class UnicodeEncoderException : public std::runtime_error
-    {
-    public:
-        /*
-        [[nodiscard]]
-        char const* what() const override
-        {
-            return std::format("Pcre2 error: {0}, error code: {1}, error offset: {2}",
-                std::exception::what(), m_errCode, m_errOffset).c_str();
-        }
-        */
-        //UnicodeEncoderException()
-    };
-
+    //text contains a special token that is not allowed to be there
+    [[noreturn]] void ThrowDisallowedSpecial();
 }
\ No newline at end of file
@@ -6,32 +6,13 @@
 #include <set>
 #include <unordered_map>
 #include <cstdint>
-
-template<>
-struct std::hash<std::vector<uint8_t>>
-{
-    //FNV hash ı
-    std::size_t operator()(const std::vector<uint8_t>& va) const noexcept
-    {
-        int p = 16777619;
-        std::size_t hash = 2166136261L;
-        for (std::size_t i = 0; i < va.size(); i++)
-        {
-            hash = (hash ^ va[i]) * p;
-        }
-
-        hash += hash << 13;
-        hash ^= hash >> 7;
-        hash += hash << 3;
-        hash ^= hash >> 17;
-        hash += hash << 5;
-
-        return hash;
-    }
-};
+#include <span>
+#include <functional>
 
 namespace TiktokenCpp
 {
+    using ByteSpan = std::span<const uint8_t>;
+
     using Utf8StringSet = std::set<std::string>;
     using StringSet = std::set<std::string>;
     using StringSetUnion = std::variant<std::string_view, StringSet>;
@@ -39,8 +20,36 @@ namespace TiktokenCpp
     using Utf8StrToInt = std::unordered_map<std::string, uint32_t>;
     using StrViewToInt = std::unordered_map<std::string_view, uint32_t>;
 
-    using encode_dict = std::unordered_map<std::vector<uint8_t>, uint32_t>;
     using decode_dict = std::unordered_map<uint32_t, std::string>;
 
+    //counters of the piece -> tokens cache of an encoding
+    struct PieceCacheStats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        std::size_t entries = 0;
+        std::size_t memory = 0; //bytes held by cached entries
+        std::size_t limit = 0;  //memory cap, 0 means the cache is disabled
+    };
+
+    //receives tokens while a text is encoded, one chunk at a time
+    using TokenSink = std::function<void(std::span<const uint32_t>)>;
+
+    //tokens of the first pieces of a text, they are the tokens of text[0, bytes)
+    struct TokenPrefix
+    {
+        std::vector<uint32_t> tokens;
+        std::size_t bytes = 0;
+    };
+
+    //tokens of a text with the part of the text each one comes from. a character split over
+    //several tokens belongs to the token with its first byte in utf16, the others are empty there
+    struct TokenOffsets
+    {
+        std::vector<uint32_t> tokens;
+        std::vector<std::pair<std::size_t, std::size_t>> bytes; //[start, end) of tokens[i] in the UTF-8 text
+        std::vector<std::pair<std::size_t, std::size_t>> utf16; //same in UTF-16 code units, empty unless asked for
+    };
+
 }
 
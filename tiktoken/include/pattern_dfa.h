@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace TiktokenCpp
+{
+    //transition flag: the pattern matched right before the symbol of this transition
+    constexpr uint16_t PATTERN_DFA_MATCH = 0x8000;
+    constexpr uint16_t PATTERN_DFA_DEAD_STATE = 0;
+    constexpr uint16_t PATTERN_DFA_START_STATE = 1;
+
+    //DFA of a split pattern, generated at build time by tools/regex_dfa.cpp (cmake option
+    //GENERATE_PATTERN_DFA). the alphabet is made of the code points the pattern names
+    //literally, one symbol for all other code points of every CharClass, and an end of
+    //text symbol. transitions carry a match flag, so one-symbol lookaheads like (?!\S)
+    //and leftmost-first alternation are resolved while the DFA is built.
+    struct PatternDfa
+    {
+        const char* pattern;
+        uint32_t stateCount;
+        uint32_t symbolCount;             //the last symbol is the end of text
+        const uint8_t* asciiSymbols;      //[128]
+        const uint8_t* classSymbols;      //[4], symbol of the other code points of each CharClass
+        const uint32_t* extraCodePoints;  //sorted non-ASCII code points with their own symbol
+        const uint8_t* extraSymbols;
+        uint32_t extraCount;
+        const uint16_t* transitions;      //[stateCount * symbolCount], next state | PATTERN_DFA_MATCH
+    };
+
+    //nullptr if no DFA was generated for pattern
+    const PatternDfa* FindPatternDfa(std::string_view pattern);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <shared_mutex>
+#include <atomic>
+#include "global_define.h"
+
+namespace TiktokenCpp
+{
+    constexpr std::size_t PIECE_CACHE_SHARDS = 16;
+    constexpr std::size_t PIECE_CACHE_DEFAULT_LIMIT = 8 * 1024 * 1024;
+    //longer pieces are rare and expensive to keep, they are never cached
+    constexpr std::size_t PIECE_CACHE_MAX_PIECE = 128;
+
+    //bounded piece bytes -> tokens cache in front of the byte pair merge.
+    //entries are spread over shards by hash, every shard has its own reader/writer
+    //lock and evicts with the CLOCK algorithm once its share of the memory limit is used.
+    //all members are thread safe, lookups of different threads only share a lock when
+    //their pieces land in the same shard.
+    class PieceCache final
+    {
+    public:
+        explicit PieceCache(std::size_t limit = PIECE_CACHE_DEFAULT_LIMIT);
+        PieceCache(const PieceCache&) = delete;
+        PieceCache& operator=(const PieceCache&) = delete;
+
+        //append cached tokens of piece to out, return false on miss
+        bool Lookup(ByteSpan piece, std::vector<uint32_t>& out);
+        //number of cached tokens of piece, return false on miss
+        bool LookupCount(ByteSpan piece, std::size_t& count);
+        void Insert(ByteSpan piece, std::span<const uint32_t> tokens);
+
+        //change the memory limit, entries over the new limit are evicted. 0 disables the cache
+        void SetLimit(std::size_t limit);
+        PieceCacheStats GetStats() const;
+        std::size_t MemoryUsage() const;
+
+    private:
+        struct CacheEntry
+        {
+            std::string piece; //empty for a free entry
+            std::vector<uint32_t> tokens;
+            std::atomic<bool> referenced{ false };
+        };
+
+        struct PieceHash
+        {
+            std::size_t operator()(std::string_view piece) const;
+        };
+
+        struct alignas(64) CacheShard
+        {
+            mutable std::shared_mutex mutex;
+            std::unordered_map<std::string_view, uint32_t, PieceHash> index; //keys point to entries[i].piece
+            std::deque<CacheEntry> entries; //deque keeps entries in place, CLOCK hand walks over it
+            std::vector<uint32_t> freeEntries;
+            std::size_t hand = 0;
+            std::size_t memory = 0;
+            std::size_t limit = 0;
+            std::atomic<uint64_t> hits{ 0 };
+            std::atomic<uint64_t> misses{ 0 };
+        };
+
+        static std::size_t EntryCost(std::size_t pieceSize, std::size_t tokenCount);
+        CacheShard& ShardOf(std::string_view piece);
+        //evict until extra bytes fit into the shard limit, caller holds the writer lock
+        static void MakeRoom(CacheShard& shard, std::size_t extra);
+
+        CacheShard m_shards[PIECE_CACHE_SHARDS];
+        std::atomic<bool> m_enabled{ true };
+    };
+}
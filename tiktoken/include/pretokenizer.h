@@ -0,0 +1,47 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+
+namespace TiktokenCpp
+{
+    //splits text into the pieces a split pattern would match, one piece per call.
+    //implementations are immutable and can be shared by any number of threads.
+    class Pretokenizer
+    {
+    public:
+        virtual ~Pretokenizer() = default;
+
+        //end of the piece starting at pos (pos < text.size()), text must be valid UTF-8.
+        //returns pos if the pattern does not match at pos, the caller falls back to PCRE2 then
+        virtual std::size_t NextPiece(std::string_view text, std::size_t pos) const = 0;
+    };
+
+    //fastest scanner for pattern: hand-written, then generated DFA, nullptr if there is
+    //neither (PCRE2 is used then)
+    std::unique_ptr<const Pretokenizer> CreatePretokenizer(std::string_view pattern);
+
+    //hand-written scanner with exactly the splits of pattern, nullptr if there is none
+    std::unique_ptr<const Pretokenizer> CreateHandWrittenPretokenizer(std::string_view pattern);
+
+    //scanner running the DFA generated at build time for pattern, nullptr if there is none
+    std::unique_ptr<const Pretokenizer> CreateGeneratedPretokenizer(std::string_view pattern);
+
+    //PCRE2 match at every piece, the reference the other scanners are tested against.
+    //jit enables PCRE2 JIT compilation, interpreted matching is used if it is not available
+    std::unique_ptr<const Pretokenizer> CreateRegexPretokenizer(std::string_view pattern, bool jit = false);
+
+    //true if the split pattern is one FindResyncPoint() is proven for (r50k, p50k and cl100k)
+    bool HasResyncPoints(std::string_view pattern);
+    //first p >= from where text[p - 2] is printable ASCII, text[p - 1] is '\n' and text[p] is
+    //an ASCII letter, std::string_view::npos if there is none. with the patterns above a piece
+    //always ends at p, and no match before p looks at text[p]: splitting text[0, p) and
+    //text[p, ...) on their own gives the pieces of the whole text
+    std::size_t FindResyncPoint(std::string_view text, std::size_t from);
+
+    //strict UTF-8 check as PCRE2 does it: no overlong forms, surrogates or code points above U+10FFFF.
+    //SIMD validation of the whole text where SSSE3 is enabled at compile time
+    bool IsValidUtf8(std::string_view text);
+    //length of the longest valid prefix of text, the offset of the first invalid sequence
+    std::size_t ValidUtf8Length(std::string_view text);
+}
@@ -16,6 +16,10 @@ namespace TiktokenCpp
         StrViewToInt special_tokens;
     }EncodingParam;
 
+    //split patterns of the registered encodings
+    extern const char* const R50K_PAT_STR;
+    extern const char* const CL100K_PAT_STR;
+
     class Registry final
     {
     public:
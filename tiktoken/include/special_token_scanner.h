@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <optional>
+#include "global_define.h"
+
+namespace TiktokenCpp
+{
+    struct SpecialTokenMatch
+    {
+        std::size_t start;
+        std::size_t end;
+        uint32_t index; //index of the token in the scanner
+    };
+
+    //Aho-Corasick automaton over the special tokens of an encoding, built once and
+    //read only afterwards. tokens are numbered 0..Count()-1 in byte order, a scan looks
+    //for the tokens selected by a mask of these indexes. text is scanned in one pass, a
+    //memchr skips to the next candidate when all tokens start with the same byte ('<').
+    class SpecialTokenScanner final
+    {
+    public:
+        SpecialTokenScanner() = default;
+        explicit SpecialTokenScanner(const Utf8StrToInt& tokens);
+
+        std::size_t Count() const { return m_tokens.size(); }
+        const std::string& Token(uint32_t index) const { return m_tokens[index]; }
+        uint32_t TokenId(uint32_t index) const { return m_ids[index]; }
+        std::optional<uint32_t> IndexOf(std::string_view token) const;
+        //byte length of the longest token, 0 if there is none
+        std::size_t MaxLength() const { return m_maxLength; }
+
+        //leftmost token of mask at or after pos, the longest one if several start there
+        std::optional<SpecialTokenMatch> FindFirst(std::string_view text, std::size_t pos, const std::vector<bool>& mask) const;
+
+        std::size_t MemoryUsage() const;
+
+    private:
+        uint32_t Next(uint32_t state, uint8_t c) const { return m_transitions[state * m_classCount + m_byteClasses[c]]; }
+
+        std::vector<std::string> m_tokens; //sorted
+        std::vector<uint32_t> m_ids;
+        std::array<uint16_t, 256> m_byteClasses{}; //bytes of no token share class 0
+        uint32_t m_classCount = 1;
+        std::vector<uint32_t> m_transitions;  //complete goto function, [state * m_classCount + class]
+        std::vector<int32_t> m_outputs;       //token spelled by the state, -1 if none
+        std::vector<uint32_t> m_outputLinks;  //longest proper suffix state with an output, 0 if none
+        std::size_t m_minLength = 0;
+        std::size_t m_maxLength = 0;
+        int m_firstByte = -1; //first byte of every token, -1 if they differ
+    };
+}
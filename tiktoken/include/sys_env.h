@@ -7,19 +7,11 @@ namespace stdfs = std::filesystem;
 
 namespace TiktokenCpp
 {
+    //create cache and temp directories if they do not exist, called before writing to them
     void InitSystemEnv();
     stdfs::path GetCacheFileFullPath(const std::string_view& filename);
     std::string GetCachePathName();
     std::string GetTempPathName();
-
-    class SystemInit final
-    {
-    public:
-        SystemInit()
-        {
-            InitSystemEnv();
-        }
-    };
 }
 
 
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+
+namespace TiktokenCpp
+{
+    //fixed set of worker threads with one queue of index ranges each. a worker takes indexes
+    //from the back of its own queue and steals half of the front range of another queue when
+    //its own is empty. the thread that calls ParallelFor works on the job as well, so calls
+    //from inside a job (or with no worker at all) can not deadlock
+    class ThreadPool final
+    {
+    public:
+        explicit ThreadPool(std::size_t workers);
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+        ~ThreadPool();
+
+        //workers plus the calling thread
+        std::size_t Concurrency() const { return m_workers.size() + 1; }
+
+        //call body(i) for every i in [0, count) and return when all calls are done. the
+        //first exception thrown by body is rethrown here, after the other calls are done
+        void ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body);
+
+        //pool shared by all encodings, one worker less than hardware threads, made on first use
+        static ThreadPool& Shared();
+
+    private:
+        struct Job;
+        struct Range
+        {
+            Job* job;
+            std::size_t begin;
+            std::size_t end;
+        };
+        struct Queue
+        {
+            std::mutex mutex;
+            std::deque<Range> ranges;
+        };
+
+        //run one index, from queue self first, false if all queues are empty
+        bool RunOne(std::size_t self);
+        bool TakeOwn(std::size_t self, Range& task);
+        bool Steal(std::size_t self, Range& task);
+        void WorkerLoop(std::size_t self);
+
+        std::vector<std::unique_ptr<Queue>> m_queues; //one per worker, the last one for outside callers
+        std::vector<std::thread> m_workers;
+        std::mutex m_wakeMutex;
+        std::condition_variable m_wake;
+        std::atomic<std::int64_t> m_queued{ 0 }; //indexes in queues, briefly negative while a job is pushed
+        bool m_stop = false;
+    };
+}
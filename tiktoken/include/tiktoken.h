@@ -11,16 +11,28 @@ namespace TiktokenCpp
     //list current encoding
     std::vector<std::string_view> ListEncodingNames();
 
-    //is local cache existed this encoding file
+    //is local cache existed this encoding file, always true for encodings embedded into the library
     bool IsLocalEncodingCacheExisted(const std::string_view& encoding_name);
 
     std::string GetCachedEncodingFileLocation();
 
-    //get an encoding object by encoding name
-    std::unique_ptr<TikToken> GetEncoding(const std::string_view& encoding_name);
+    //get an encoding object by encoding name, every encoding is loaded once and
+    //shared by the whole process, concurrent first calls wait for the same load
+    std::shared_ptr<const TikToken> GetEncoding(const std::string_view& encoding_name);
 
-    //get an encoding object by model name
-    std::unique_ptr<TikToken> EncodingForModel(const std::string& model_name);
+    //get an encoding object by model name (shared, same as GetEncoding)
+    std::shared_ptr<const TikToken> EncodingForModel(const std::string& model_name);
+
+    //memory budget in bytes of the cached encodings (default: unlimited),
+    //when exceeded, encodings not referenced outside the cache are released (least recently used first)
+    void SetEncodingCacheBudget(std::size_t bytes);
+
+    //release all cached encodings not referenced outside the cache, return the number released
+    std::size_t ReleaseIdleEncodings();
+
+    //convert the cached .tiktoken file of an encoding to the binary format (<name>.tkbin) next to it,
+    //later loads map the binary file directly. return false if the encoding is not in local cache
+    bool ConvertEncodingToBinary(const std::string_view& encoding_name);
 
     //download encoding to local cache,
     //proxy support: http://127.0.0.1:8080, or https://127.0.0.1:8081, or socks5://127.0.0.1:8089 
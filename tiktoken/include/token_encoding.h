@@ -2,6 +2,8 @@
 
 #include <string_view>
 #include <vector>
+#include <memory>
+#include <span>
 #include "registry.h"
 #include "model.h"
 #include "global_define.h"
@@ -9,7 +11,39 @@
 namespace TiktokenCpp
 {
     class CoreBpe;
+    class TikToken;
 
+    //allowed and disallowed special tokens of one encoding, resolved once and reused by
+    //any number of Encode() calls (and threads). allowedSpecial/disallowedSpecial take
+    //"all", a single token or a set of tokens, as in TikToken::Encode().
+    class EncodeOptions final
+    {
+    public:
+        EncodeOptions(const TikToken& encoding, StringSetUnion allowedSpecial = StringSet{}, StringSetUnion disallowedSpecial = "all");
+
+        bool IsAllowed(std::string_view token) const;
+        bool IsDisallowed(std::string_view token) const;
+    private:
+        friend class TikToken;
+
+        const TikToken* m_encoding;
+        std::vector<bool> m_allowed;     //by special token index of the encoding
+        std::vector<bool> m_disallowed;
+        bool m_anyAllowed = false;
+        bool m_anyDisallowed = false;
+        std::vector<std::string> m_unknownDisallowed; //disallowed strings that are no special token
+    };
+
+    //tokens of many texts in one buffer, tokens of text i are tokens[offsets[i]] up to
+    //tokens[offsets[i + 1]]. offsets has one entry more than there are texts
+    struct TokenBatch
+    {
+        std::vector<uint32_t> tokens;
+        std::vector<std::size_t> offsets;
+    };
+
+    //a TikToken is immutable once constructed, all members are const and
+    //one instance can be shared by any number of threads
     class TikToken final
     {
     public:
@@ -18,20 +52,99 @@ namespace TiktokenCpp
         ~TikToken();
         TikToken& operator=(const TikToken& token) = delete;
 
-        std::vector<uint32_t> EncodeOrdinary(const std::string& utf8Text);
+        std::vector<uint32_t> EncodeOrdinary(const std::string& utf8Text) const;
         std::vector<uint32_t> Encode(const std::string& utf8Text,
                                     StringSetUnion allowedSpecial = StringSet{},
-                                    StringSetUnion disallowedSpecial = "all");
+                                    StringSetUnion disallowedSpecial = "all") const;
+        //options must be made for this encoding, throw std::invalid_argument otherwise
+        std::vector<uint32_t> Encode(const std::string& utf8Text, const EncodeOptions& options) const;
+        //wide text, UTF-16 or UTF-32 as wchar_t is, is encoded without a UTF-8 copy of it
+        std::vector<uint32_t> EncodeOrdinary(const std::wstring& wideText) const;
+        std::vector<uint32_t> Encode(const std::wstring& wideText,
+                                    StringSetUnion allowedSpecial = StringSet{},
+                                    StringSetUnion disallowedSpecial = "all") const;
+        std::vector<uint32_t> Encode(const std::wstring& wideText, const EncodeOptions& options) const;
+
+        //append the tokens to a caller's vector, a vector reused over calls only grows while
+        //it is too small
+        void EncodeOrdinaryInto(std::string_view utf8Text, std::vector<uint32_t>& tokens) const;
+        void EncodeInto(std::string_view utf8Text, const EncodeOptions& options, std::vector<uint32_t>& tokens) const;
+        //write the tokens into buffer and return how many tokens the text has. if that is more
+        //than buffer.size() only the first buffer.size() tokens are written. a vector passed as is
+        //is appended to, std::span(vector) writes over its elements
+        std::size_t EncodeOrdinaryInto(std::string_view utf8Text, std::span<uint32_t> buffer) const;
+        std::size_t EncodeInto(std::string_view utf8Text, const EncodeOptions& options, std::span<uint32_t> buffer) const;
+        //give the tokens to sink while the text is encoded, in chunks of at least chunkTokens
+        //tokens (the last one may be shorter). the chunk is only valid during the call
+        void EncodeOrdinaryInto(std::string_view utf8Text, const TokenSink& sink, std::size_t chunkTokens = 4096) const;
+        void EncodeInto(std::string_view utf8Text, const EncodeOptions& options, const TokenSink& sink, std::size_t chunkTokens = 4096) const;
+
+        //number of tokens EncodeOrdinary() / Encode() give, without storing the tokens. with
+        //EncodeOptions and a warm piece cache nothing is allocated per call
+        std::size_t CountTokensOrdinary(std::string_view utf8Text) const;
+        std::size_t CountTokens(std::string_view utf8Text,
+                                StringSetUnion allowedSpecial = StringSet{},
+                                StringSetUnion disallowedSpecial = "all") const;
+        std::size_t CountTokens(std::string_view utf8Text, const EncodeOptions& options) const;
+
+        //tokens with the [start, end) bytes of utf8Text each one comes from, and with UTF-16 code
+        //unit offsets (as JavaScript strings count) if withUtf16 is set
+        TokenOffsets EncodeOrdinaryWithOffsets(std::string_view utf8Text, bool withUtf16 = false) const;
+        TokenOffsets EncodeWithOffsets(std::string_view utf8Text, const EncodeOptions& options, bool withUtf16 = false) const;
+
+        //tokens of EncodeOrdinary() for the whole pieces of utf8Text that fit into maxTokens, the
+        //rest of the text is not encoded. bytes is where the last included piece ends
+        TokenPrefix EncodeUpTo(std::string_view utf8Text, std::size_t maxTokens) const;
+        //longest valid UTF-8 prefix of utf8Text (ending where a piece ends) with no more than
+        //maxTokens tokens, a view into utf8Text
+        std::string_view PrefixUpTo(std::string_view utf8Text, std::size_t maxTokens) const;
+
+        //texts are encoded in parallel on a thread pool shared by all encodings, tokens of
+        //texts[i] are in result[i]. without options they are encoded as by EncodeOrdinary()
+        std::vector<std::vector<uint32_t>> EncodeBatch(std::span<const std::string_view> texts) const;
+        std::vector<std::vector<uint32_t>> EncodeBatch(std::span<const std::string_view> texts, const EncodeOptions& options) const;
+        //same tokens in one flat buffer
+        TokenBatch EncodeBatchFlat(std::span<const std::string_view> texts) const;
+        TokenBatch EncodeBatchFlat(std::span<const std::string_view> texts, const EncodeOptions& options) const;
+        //one large text encoded in parallel, split where the split pattern provably starts over
+        //(a newline between printable ASCII and a letter). tokens are the same as EncodeOrdinary()
+        //gives, chunkBytes is the least part size, 0 to choose it from the number of threads
+        std::vector<uint32_t> EncodeOrdinaryParallel(std::string_view utf8Text, std::size_t chunkBytes = 0) const;
         
-        std::string Decode(const std::vector<uint32_t>& tokens);
+        std::string Decode(const std::vector<uint32_t>& tokens) const;
+        //exact byte length of Decode(tokens)
+        std::size_t DecodedLength(std::span<const uint32_t> tokens) const;
+        //decode into caller's buffer without allocation, return bytes written.
+        //throw std::length_error if buffer is smaller than DecodedLength(tokens)
+        std::size_t DecodeInto(std::span<const uint32_t> tokens, std::span<char> buffer) const;
+        //decoded in parallel, in the order of batch
+        std::vector<std::string> DecodeBatch(std::span<const std::vector<uint32_t>> batch) const;
+        std::vector<std::string> DecodeBatch(const TokenBatch& batch) const;
         std::string TokenToSymbol(uint32_t token) const;
         std::vector<std::string> TokenToSymbols(const std::vector<uint32_t>& tokens) const;
         
         std::string_view GetName() const { return m_name; }
+        //approximate heap memory held by this encoding
+        std::size_t MemoryUsage() const;
+
+        //pieces that are not in the vocabulary are cached with their tokens, the cache is
+        //shared by all users of this encoding. hit and miss counters only count those pieces
+        PieceCacheStats GetPieceCacheStats() const;
+        //memory cap of the piece cache (8MB by default), 0 disables it
+        void SetPieceCacheLimit(std::size_t bytes) const;
     protected:
     private:
-        std::unique_ptr<CoreBpe> m_corebpe;
-        StringSet m_SpecialTokensSet;
+        friend class EncodeOptions;
+
+        //append tokens of utf8Text, as EncodeOrdinary() if options is nullptr
+        void AppendTokens(std::string_view utf8Text, const EncodeOptions* options, std::vector<uint32_t>& tokens) const;
+        //throw if utf8Text contains a special token options disallow
+        void CheckDisallowed(std::string_view utf8Text, const EncodeOptions& options) const;
+        std::vector<std::vector<uint32_t>> EncodeBatch(std::span<const std::string_view> texts, const EncodeOptions* options) const;
+        TokenBatch EncodeBatchFlat(std::span<const std::string_view> texts, const EncodeOptions* options) const;
+
+        std::unique_ptr<const CoreBpe> m_corebpe;
+        StringSet m_SpecialTokensSet; //UTF-8, as CoreBpe's special tokens
         std::uint32_t m_maxTokenValue = 0;
         std::string_view m_name;
     };
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+namespace TiktokenCpp
+{
+    //character classes used by the split patterns, every code point is in exactly one of them
+    enum class CharClass : uint8_t
+    {
+        Other = 0,  //[^\s\p{L}\p{N}]
+        Letter = 1, //\p{L}
+        Number = 2, //\p{N}
+        Space = 3   //\s (with PCRE2_UCP)
+    };
+
+    //two-stage table generated by tools/unicode_tables.cpp: stage 1 maps the high bits of a
+    //code point to a block of 256 code points, stage 2 holds 2 bits per code point of a block
+    extern const uint8_t UNICODE_CLASS_STAGE1[0x1100];
+    extern const uint8_t UNICODE_CLASS_STAGE2[];
+
+    inline CharClass GetCharClass(uint32_t cp)
+    {
+        if (cp >= 0x110000)
+            return CharClass::Other;
+
+        uint8_t packed = UNICODE_CLASS_STAGE2[UNICODE_CLASS_STAGE1[cp >> 8] * 64 + ((cp & 0xFF) >> 2)];
+        return static_cast<CharClass>((packed >> ((cp & 3) * 2)) & 3);
+    }
+}
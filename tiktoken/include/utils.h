@@ -5,20 +5,30 @@
 #include <optional>
 #include <memory>
 #include "global_define.h"
+#include "bpe_vocab.h"
 
 
 namespace TiktokenCpp
 {
     //load a encoding file by path name
-    std::unique_ptr<encode_dict> LoadTiktokenBpe(const std::string& pathname);
+    std::unique_ptr<BpeVocab> LoadTiktokenBpe(const std::string& pathname);
 
-    //load a encoding file by encoding name (get file from local cache)
-    std::unique_ptr<encode_dict> GetTiktokenEncoding(const std::string_view& name);
+    //load a encoding file by encoding name. embedded encodings are used first, then
+    //files from local cache, a valid binary vocabulary file (<name>.tkbin) is used in place of the .tiktoken file
+    std::unique_ptr<BpeVocab> GetTiktokenEncoding(const std::string_view& name);
+
+    //convert <name>.tiktoken in local cache to <name>.tkbin, return false if the .tiktoken file is missing
+    bool ConvertTiktokenToBinary(const std::string_view& name);
 
     //process escape char replacement
     std::string EscapeRegex(const std::string& str);
 
     std::vector<uint8_t> StringToBytes(const std::string& str);
+    //view string content as token bytes, no copy
+    inline ByteSpan ToByteSpan(std::string_view str)
+    {
+        return ByteSpan(reinterpret_cast<const uint8_t*>(str.data()), str.size());
+    }
     std::string BytesToString(const std::vector<uint8_t>& bytes);
     Utf8StringSet Utf8StrsetFromStrSet(const StringSet& strSet);
 
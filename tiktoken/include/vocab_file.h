@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <optional>
+#include "global_define.h"
+#include "bpe_vocab.h"
+
+namespace TiktokenCpp
+{
+    //binary vocabulary file: <encoding name>.tkbin, next to the .tiktoken file.
+    //all sections are 8 bytes aligned and stored in host byte order, so the file
+    //can be mapped and used in place. layout:
+    //  VocabFileHeader
+    //  token bytes arena (ordered by rank)
+    //  rank offsets: uint32_t[rankCount + 1]
+    //  index: VocabSlot[slotCount]
+    //  special tokens: VocabFileSpecial[specialCount], then their bytes
+    constexpr uint32_t VOCAB_FILE_MAGIC = 0x56424B54; //"TKBV" on disk, does not match on hosts of other byte order
+    constexpr uint32_t VOCAB_FILE_VERSION = 2;
+    constexpr const char* VOCAB_FILE_EXTENSION = ".tkbin";
+
+    struct VocabFileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t fileSize;
+        uint64_t sourceSize; //size of the .tiktoken file it was converted from
+        uint64_t sourceHash; //VocabHashBytes of that file
+        uint64_t tokenCount;
+        uint64_t rankCount;
+        uint64_t slotCount;
+        uint64_t arenaOffset;
+        uint64_t arenaSize;
+        uint64_t offsetsOffset;
+        uint64_t slotsOffset;
+        uint64_t specialOffset;
+        uint64_t specialCount;
+        uint64_t specialBytesOffset;
+        uint64_t specialBytesSize;
+    };
+
+    struct VocabFileSpecial
+    {
+        uint32_t token;
+        uint32_t offset; //in special tokens bytes
+        uint32_t length;
+        uint32_t reserved;
+    };
+
+    //size and content hash of the .tiktoken file a binary vocabulary file is converted from
+    struct VocabSource
+    {
+        uint64_t size = 0;
+        uint64_t hash = 0;
+    };
+
+    //map and hash a .tiktoken file, std::nullopt if it can not be read
+    std::optional<VocabSource> ReadVocabSource(const std::string& pathname);
+
+    //write vocab and special tokens to a binary vocabulary file, throw std::runtime_error on failure
+    void SaveBinaryVocab(const BpeVocab& vocab, const StrViewToInt& specialTokens, const VocabSource& source, const std::string& pathname);
+
+    //map a binary vocabulary file. return nullptr if the file is missing, invalid, was converted
+    //from another .tiktoken file than source (when there is one), or its special tokens differ
+    std::unique_ptr<BpeVocab> LoadBinaryVocab(const std::string& pathname, const StrViewToInt& specialTokens,
+                                              const std::optional<VocabSource>& source);
+}
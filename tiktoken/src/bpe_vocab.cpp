@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <stdexcept>
+#include <bit>
+#include "bpe_vocab.h"
+
+namespace TiktokenCpp
+{
+    void BpeVocab::Reserve(std::size_t count, std::size_t bytes)
+    {
+        m_pending.reserve(count);
+        m_arenaStorage.reserve(bytes);
+    }
+
+    void BpeVocab::Add(ByteSpan bytes, uint32_t rank)
+    {
+        if (bytes.empty())
+            throw std::runtime_error("empty token in vocabulary");
+
+        m_pending.push_back({ rank, static_cast<uint32_t>(m_arenaStorage.size()), static_cast<uint32_t>(bytes.size()) });
+        m_arenaStorage.insert(m_arenaStorage.end(), bytes.begin(), bytes.end());
+    }
+
+    void BpeVocab::Build()
+    {
+        std::sort(m_pending.begin(), m_pending.end(),
+            [](const PendingToken& a, const PendingToken& b) { return a.rank < b.rank; });
+
+        //lay the arena out in rank order, so token bytes can be addressed by rank
+        std::vector<uint8_t> arena;
+        arena.reserve(m_arenaStorage.size());
+        std::vector<uint32_t> offsets;
+        offsets.reserve(m_pending.empty() ? 1 : m_pending.back().rank + 2);
+        offsets.push_back(0);
+        for (std::size_t i = 0; i < m_pending.size(); i++)
+        {
+            const PendingToken& token = m_pending[i];
+            if ((i > 0) && (m_pending[i - 1].rank == token.rank))
+                throw std::runtime_error("duplicated rank in vocabulary");
+
+            while (offsets.size() <= token.rank) //rank gap, empty token
+                offsets.push_back(static_cast<uint32_t>(arena.size()));
+            arena.insert(arena.end(), m_arenaStorage.begin() + token.offset, m_arenaStorage.begin() + token.offset + token.length);
+            offsets.push_back(static_cast<uint32_t>(arena.size()));
+        }
+        m_pending.clear();
+        m_pending.shrink_to_fit();
+
+        Assign(std::move(arena), std::move(offsets));
+    }
+
+    void BpeVocab::Assign(std::vector<uint8_t> arena, std::vector<uint32_t> offsets)
+    {
+        if (offsets.empty() || (offsets.back() > arena.size()))
+            throw std::runtime_error("invalid vocabulary tables");
+
+        std::size_t tokens = 0;
+        for (std::size_t rank = 0; rank + 1 < offsets.size(); rank++)
+        {
+            if (offsets[rank + 1] < offsets[rank])
+                throw std::runtime_error("invalid vocabulary rank offsets");
+            if (offsets[rank + 1] != offsets[rank])
+                tokens++;
+        }
+
+        m_arenaStorage = std::move(arena);
+        m_offsetsStorage = std::move(offsets);
+        m_arena = m_arenaStorage;
+        m_offsets = m_offsetsStorage;
+        m_owner.reset();
+        m_pending.clear();
+
+        //the table is sized once, load factor below 0.5 keeps linear probing chains short
+        std::size_t capacity = std::bit_ceil(std::max<std::size_t>(16, tokens * 2));
+        m_slotsStorage.assign(capacity, VocabSlot{ 0, 0, 0 });
+        m_slots = m_slotsStorage;
+        m_displacementsStorage.clear();
+        m_displacements = {};
+        m_mask = capacity - 1;
+        m_count = 0;
+        for (uint32_t rank = 0; rank < RankCount(); rank++)
+        {
+            ByteSpan bytes = TokenBytes(rank);
+            if (bytes.empty() || Find(bytes).has_value()) //rank gap, or keep the first one of duplicated tokens
+                continue;
+
+            VocabSlot slot{ 0, rank, static_cast<uint32_t>(bytes.size()) };
+            std::size_t i = 0;
+            if (bytes.size() <= PACKED_TOKEN_MAX)
+            {
+                slot.key = PackTokenBytes(bytes);
+                i = VocabHashPacked(slot.key, bytes.size()) & m_mask;
+            }
+            else
+            {
+                slot.key = m_offsets[rank];
+                i = VocabHashBytes(bytes) & m_mask;
+            }
+            while (m_slotsStorage[i].length != 0)
+                i = (i + 1) & m_mask;
+
+            m_slotsStorage[i] = slot;
+            m_count++;
+        }
+    }
+
+    void BpeVocab::BuildPerfectIndex()
+    {
+        const std::size_t count = m_count;
+        if (count == 0)
+            return;
+
+        struct PerfectKey
+        {
+            uint64_t hash;
+            VocabSlot slot;
+        };
+        std::vector<PerfectKey> keys;
+        keys.reserve(count);
+        for (const VocabSlot& slot : m_slots)
+        {
+            if (slot.length == 0)
+                continue;
+
+            ByteSpan bytes = TokenBytes(slot.rank);
+            uint64_t hash = (bytes.size() <= PACKED_TOKEN_MAX) ? VocabHashPacked(slot.key, bytes.size()) : VocabHashBytes(bytes);
+            keys.push_back({ hash, slot });
+        }
+
+        //group keys by bucket, place the biggest buckets first while the table is still empty
+        const std::size_t bucketCount = (count + 3) / 4;
+        std::vector<uint32_t> bucketStart(bucketCount + 1, 0);
+        for (const PerfectKey& key : keys)
+            bucketStart[VocabHashRange(key.hash >> 32, bucketCount) + 1]++;
+        std::vector<uint32_t> order(bucketCount);
+        for (std::size_t i = 0; i < bucketCount; i++)
+        {
+            order[i] = static_cast<uint32_t>(i);
+            bucketStart[i + 1] += bucketStart[i];
+        }
+        std::vector<PerfectKey> grouped(count);
+        std::vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (const PerfectKey& key : keys)
+            grouped[fill[VocabHashRange(key.hash >> 32, bucketCount)]++] = key;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+            { return (bucketStart[a + 1] - bucketStart[a]) > (bucketStart[b + 1] - bucketStart[b]); });
+
+        std::vector<VocabSlot> slots(count, VocabSlot{ 0, 0, 0 });
+        std::vector<uint32_t> displacements(bucketCount, 0);
+        std::vector<std::size_t> positions;
+        for (uint32_t bucket : order)
+        {
+            std::span<const PerfectKey> members(grouped.data() + bucketStart[bucket], bucketStart[bucket + 1] - bucketStart[bucket]);
+            if (members.empty())
+                break; //sorted by size, the rest are empty too
+
+            for (uint32_t displacement = 0;; displacement++)
+            {
+                if (displacement == UINT32_MAX)
+                    throw std::runtime_error("can not build perfect hash of vocabulary");
+
+                positions.clear();
+                bool placed = true;
+                for (const PerfectKey& key : members)
+                {
+                    std::size_t pos = VocabHashRange(VocabHashMix(key.hash + displacement), count);
+                    if ((slots[pos].length != 0) || (std::find(positions.begin(), positions.end(), pos) != positions.end()))
+                    {
+                        placed = false;
+                        break;
+                    }
+                    positions.push_back(pos);
+                }
+                if (!placed)
+                    continue;
+
+                for (std::size_t i = 0; i < members.size(); i++)
+                    slots[positions[i]] = members[i].slot;
+                displacements[bucket] = displacement;
+                break;
+            }
+        }
+
+        m_slotsStorage = std::move(slots);
+        m_displacementsStorage = std::move(displacements);
+        m_slots = m_slotsStorage;
+        m_displacements = m_displacementsStorage;
+        m_mask = 0;
+    }
+
+    void BpeVocab::Attach(ByteSpan arena, std::span<const uint32_t> offsets, std::span<const VocabSlot> slots,
+                          std::size_t count, std::shared_ptr<const void> owner, std::span<const uint32_t> displacements)
+    {
+        //only cheap consistency checks that make lookups memory safe
+        if (offsets.empty() || (offsets.back() > arena.size()))
+            throw std::runtime_error("invalid vocabulary tables");
+        if (displacements.empty() ? (!std::has_single_bit(slots.size()) || (count >= slots.size())) : (count != slots.size()))
+            throw std::runtime_error("invalid vocabulary tables");
+        for (std::size_t i = 1; i < offsets.size(); i++)
+        {
+            if (offsets[i] < offsets[i - 1])
+                throw std::runtime_error("invalid vocabulary rank offsets");
+        }
+        std::size_t used = 0;
+        for (const VocabSlot& slot : slots)
+        {
+            if (slot.length == 0)
+                continue;
+            if ((slot.length > PACKED_TOKEN_MAX) && ((slot.key > arena.size()) || (slot.length > arena.size() - slot.key)))
+                throw std::runtime_error("invalid vocabulary index");
+            used++;
+        }
+        if (used != count)
+            throw std::runtime_error("invalid vocabulary index");
+
+        m_arenaStorage.clear();
+        m_offsetsStorage.clear();
+        m_slotsStorage.clear();
+        m_displacementsStorage.clear();
+        m_pending.clear();
+
+        m_arena = arena;
+        m_offsets = offsets;
+        m_slots = slots;
+        m_displacements = displacements;
+        m_mask = displacements.empty() ? slots.size() - 1 : 0;
+        m_count = count;
+        m_owner = std::move(owner);
+    }
+
+    std::size_t BpeVocab::MemoryUsage() const
+    {
+        //attached tables are counted too, mapped pages still take memory once touched
+        return m_arena.size() + (m_offsets.size() + m_displacements.size()) * sizeof(uint32_t) + m_slots.size() * sizeof(VocabSlot);
+    }
+}
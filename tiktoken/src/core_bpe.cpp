@@ -1,237 +1,681 @@
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/replace.hpp>
+#include <queue>
+#include <type_traits>
 #include "utils.h"
 #include "Utf8String.h"
 #include "core_bpe.h"
 #include "pcre2cpp.h"
+#include "error_handler.h"
+#include "thread_pool.h"
 
 
 namespace TiktokenCpp
 {
-    CoreBpe::CoreBpe(std::unique_ptr<encode_dict> encoder, const StrViewToInt& specialTokensEncoder, const std::string_view& pattern)
+    //large enough for the pattern regexes, only the whole match (pair 0) is used
+    const uint32_t SCRATCH_OVECTOR_SIZE = 4;
+    //wchar_t transcoded to UTF-8 at a time by EncodeWide
+    const std::size_t WIDE_CHUNK_SIZE = 4096;
+    //EncodeOrdinaryParallel encodes smaller texts serially, and never makes parts smaller than this
+    const std::size_t PARALLEL_MIN_CHUNK = 1024 * 1024;
+
+    //per-thread pcre2 match data, JIT stack and match context, CoreBpe itself holds no mutable state
+    struct ThreadScratch
+    {
+        ThreadScratch() { matchContext.AssignJitStack(jitStack); }
+
+        Pcre2::CPcre2MatchData wordMatch{ SCRATCH_OVECTOR_SIZE };
+        Pcre2::CPcre2JitStack jitStack;
+        Pcre2::CPcre2MatchContext matchContext{ true };
+        std::vector<std::pair<size_t, size_t>> mergeParts; //BytePairMerge, reused for every piece
+        std::string wideChunk; //EncodeWide, UTF-8 of the wide text not encoded yet
+        std::vector<uint32_t> countTokens; //CountBytes and CountPiece, tokens that are only counted
+        std::vector<uint32_t> spanTokens; //EncodeNativeToSpan, merged pieces on their way into the span
+    };
+
+    static ThreadScratch& GetThreadScratch()
+    {
+        static thread_local ThreadScratch scratch;
+        return scratch;
+    }
+
+    CoreBpe::CoreBpe(std::unique_ptr<BpeVocab> encoder, const StrViewToInt& specialTokensEncoder, const std::string_view& pattern)
     {
         m_encoder = std::move(encoder);
+        m_pretokenizer = CreatePretokenizer(pattern);
+        m_resyncSplit = HasResyncPoints(pattern);
         m_Regex.Compile(pattern.data());
+        m_Regex.JitCompile(); //interpreted matching if JIT is not available
 
         m_specialTokensEncoder.reserve(specialTokensEncoder.size());
         std::for_each(specialTokensEncoder.begin(), specialTokensEncoder.end(),
             [this](const auto& mi) { m_specialTokensEncoder.emplace(UTF8StrFromLocalMBCS(mi.first.data()), mi.second); });
 
-        std::vector<std::string> parts(specialTokensEncoder.size());
-        std::transform(specialTokensEncoder.begin(), specialTokensEncoder.end(), parts.begin(),
-            [](const auto& mi) { return EscapeRegex(mi.first.data()); });
-        m_SpecialRegex.Compile(boost::join(parts, "|"));
+        m_specialScanner = SpecialTokenScanner(m_specialTokensEncoder);
 
         m_specialTokensDecoder.reserve(m_specialTokensEncoder.size());
         std::for_each(m_specialTokensEncoder.begin(), m_specialTokensEncoder.end(),
             [this](const auto& mi) { m_specialTokensDecoder.emplace(mi.second, mi.first); });
     }
 
-    std::string CoreBpe::TokenToSymbol(uint32_t token)
+    std::string CoreBpe::TokenToSymbol(uint32_t token) const
     {
-        if (m_decoder == nullptr)
-            m_decoder = InitDecodeDict();
-        
-        std::string symbol;
-        auto it = m_decoder->find(token);
-        if (it != m_decoder->end())
-        {
-            symbol = it->second;
-        }
+        ByteSpan bytes = TokenBytes(token);
 
-        return symbol;
+        return std::string(bytes.begin(), bytes.end());
     }
 
-    std::vector<uint32_t> CoreBpe::EncodeOrdinaryNative(const std::string& utf8Text)
+    template<typename PieceFn>
+    void CoreBpe::ForEachPiece(std::string_view utf8Text, PieceFn&& onPiece) const
     {
-        std::vector<uint32_t> tokens;
-        std::vector<std::string> words = Utf8WordsSpliter(utf8Text);
-        for (const auto& word : words)
+        auto emit = [&onPiece](ByteSpan piece) -> bool
         {
-            std::vector<uint8_t> word_bytes = StringToBytes(word);
-            //std::size_t hash = std::hash<std::vector<uint8_t>>()(word_bytes);
-            auto it = m_encoder->find(word_bytes);
-            if (it != m_encoder->end())
+            if constexpr (std::is_void_v<std::invoke_result_t<PieceFn&, ByteSpan>>)
             {
-                tokens.push_back(it->second);
+                onPiece(piece);
+                return true;
             }
             else
+                return onPiece(piece);
+        };
+
+        //where the scanner finds no match PCRE2 takes over, its matches start where the last piece ended
+        std::size_t pos = 0;
+        if (m_pretokenizer != nullptr)
+        {
+            while (pos < utf8Text.size())
             {
-                std::vector<uint32_t> word_tokens = BytePairEncode(word_bytes);
-                /*
-                tokens.insert(tokens.end(), std::make_move_iterator(word_tokens.begin()),
-                    std::make_move_iterator(word_tokens.end()));
-                */
-                std::move(word_tokens.begin(), word_tokens.end(), std::back_inserter(tokens));
+                std::size_t end = m_pretokenizer->NextPiece(utf8Text, pos);
+                if (end == pos)
+                    break;
+                if (!emit(ToByteSpan(utf8Text.substr(pos, end - pos))))
+                    return;
+                pos = end;
             }
+
+            if (pos == utf8Text.size())
+                return;
         }
 
-        return tokens;
+        //the text is validated by the caller, PCRE2 does not check it again on every call
+        ThreadScratch& scratch = GetThreadScratch();
+        Pcre2::CPcre2MatchData& matchData = scratch.wordMatch;
+        int rc = m_Regex.FastMatch(utf8Text, pos, matchData, PCRE2_NO_UTF_CHECK, scratch.matchContext);
+        while (rc > 0)
+        {
+            Pcre2::CPcre2OVector overtor(matchData.GetRawOVector(), 1);
+            Pcre2::Pcre2Match mat = overtor.First();
+            if (!emit(ToByteSpan(utf8Text.substr(mat.start, mat.end - mat.start))))
+                return;
+            rc = m_Regex.FastMatch(utf8Text, mat.end, matchData, PCRE2_NO_UTF_CHECK, scratch.matchContext);
+        }
+    }
+
+    bool CoreBpe::IsAllSpace(uint32_t token) const
+    {
+        ByteSpan bytes = m_encoder->TokenBytes(token);
+        return !bytes.empty() && std::all_of(bytes.begin(), bytes.end(), [](uint8_t c) { return (c == ' ') || (c == '\n') || (c == '\t'); });
+    }
+
+    void CoreBpe::EncodeBytes(std::string_view text, bool validUtf8, std::vector<uint32_t>& tokens) const
+    {
+        std::size_t firstToken = tokens.size();
+        if (validUtf8)
+        {
+            ForEachPiece(text, [&](ByteSpan piece) { EncodePiece(piece, tokens); });
+            return;
+        }
+
+        //as tiktoken's _encode_bytes: the valid prefix is split and encoded as usual, then the
+        //last piece (with the whitespace tokens before it, a split there may not be stable) and
+        //all bytes from the first invalid sequence on are merged as one byte level piece
+        const std::size_t validLength = ValidUtf8Length(text);
+        std::size_t lastPiece = tokens.size();
+        ForEachPiece(text.substr(0, validLength), [&](ByteSpan piece)
+            {
+                lastPiece = tokens.size();
+                EncodePiece(piece, tokens);
+            });
+        EncodeInvalidTail(text, validLength, firstToken, lastPiece, tokens);
     }
 
-    //todo: 
-    std::vector<uint32_t> CoreBpe::EncodeOrdinaryNative(const std::wstring& utf16Text)
+    std::size_t CoreBpe::EncodeInvalidTail(std::string_view text, std::size_t validLength, std::size_t firstToken,
+                                           std::size_t lastPiece, std::vector<uint32_t>& tokens) const
+    {
+        if ((lastPiece < tokens.size()) && IsAllSpace(tokens[lastPiece]))
+        {
+            while ((lastPiece > firstToken) && IsAllSpace(tokens[lastPiece - 1]))
+                lastPiece--;
+        }
+
+        std::string unstable;
+        for (std::size_t i = lastPiece; i < tokens.size(); i++)
+        {
+            ByteSpan bytes = m_encoder->TokenBytes(tokens[i]);
+            unstable.append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        }
+        unstable.append(text.substr(validLength));
+        tokens.resize(lastPiece);
+        EncodePiece(ToByteSpan(unstable), tokens);
+
+        return lastPiece;
+    }
+
+    std::size_t CoreBpe::CountBytes(std::string_view text, bool validUtf8) const
+    {
+        std::size_t count = 0;
+        if (validUtf8)
+        {
+            ForEachPiece(text, [&](ByteSpan piece) { count += CountPiece(piece); });
+            return count;
+        }
+
+        //the tail of invalid text is re-merged with tokens before it, it is encoded as usual
+        std::vector<uint32_t>& tokens = GetThreadScratch().countTokens;
+        tokens.clear();
+        EncodeBytes(text, false, tokens);
+
+        return tokens.size();
+    }
+
+    std::vector<uint32_t> CoreBpe::EncodeOrdinaryNative(std::string_view utf8Text) const
     {
         std::vector<uint32_t> tokens;
+        EncodeOrdinaryInto(utf8Text, tokens);
 
         return tokens;
     }
 
-    std::optional<std::tuple<std::size_t, std::size_t, std::string>>
-    FindFirstSpecialPosition(const std::string& utf8Text, const Utf8StringSet& allowedSpecial, const Pcre2::CPcre2OVector& overtor)
+    void CoreBpe::EncodeOrdinaryInto(std::string_view utf8Text, std::vector<uint32_t>& tokens) const
     {
-        for (const auto& mat : overtor)
+        EncodeBytes(utf8Text, IsValidUtf8(utf8Text), tokens);
+    }
+
+    std::vector<uint32_t> CoreBpe::EncodeOrdinaryParallel(std::string_view utf8Text, std::size_t chunkBytes) const
+    {
+        ThreadPool& pool = ThreadPool::Shared();
+        if (chunkBytes == 0)
         {
-            if (allowedSpecial.contains(utf8Text.substr(mat.start, mat.end - mat.start)))
+            if (pool.Concurrency() == 1)
+                return EncodeOrdinaryNative(utf8Text);
+            chunkBytes = std::max(PARALLEL_MIN_CHUNK, utf8Text.size() / (pool.Concurrency() * 4));
+        }
+        if (!m_resyncSplit || (utf8Text.size() <= chunkBytes) || !IsValidUtf8(utf8Text))
+            return EncodeOrdinaryNative(utf8Text);
+
+        std::vector<std::size_t> bounds{ 0 };
+        std::size_t cut = FindResyncPoint(utf8Text, chunkBytes);
+        while (cut != std::string_view::npos)
+        {
+            bounds.push_back(cut);
+            cut = (utf8Text.size() - cut > chunkBytes) ? FindResyncPoint(utf8Text, cut + chunkBytes) : std::string_view::npos;
+        }
+        bounds.push_back(utf8Text.size());
+
+        std::vector<std::vector<uint32_t>> chunkTokens(bounds.size() - 1);
+        pool.ParallelFor(chunkTokens.size(), [&](std::size_t chunk)
             {
-                return std::tuple{ mat.start, mat.end, utf8Text.substr(mat.start, mat.end - mat.start) };
-            }
+                EncodeBytes(utf8Text.substr(bounds[chunk], bounds[chunk + 1] - bounds[chunk]), true, chunkTokens[chunk]);
+            });
+
+        std::vector<std::size_t> offsets(chunkTokens.size() + 1, 0);
+        for (std::size_t chunk = 0; chunk < chunkTokens.size(); chunk++)
+            offsets[chunk + 1] = offsets[chunk] + chunkTokens[chunk].size();
+        std::vector<uint32_t> tokens(offsets.back());
+        pool.ParallelFor(chunkTokens.size(), [&](std::size_t chunk)
+            {
+                std::copy(chunkTokens[chunk].begin(), chunkTokens[chunk].end(), tokens.begin() + offsets[chunk]);
+            });
+
+        return tokens;
+    }
+
+    TokenPrefix CoreBpe::EncodeUpTo(std::string_view utf8Text, std::size_t maxTokens) const
+    {
+        TokenPrefix prefix;
+        if (maxTokens == 0)
+            return prefix;
+
+        std::vector<uint32_t>& tokens = prefix.tokens;
+        if (IsValidUtf8(utf8Text))
+        {
+            ForEachPiece(utf8Text, [&](ByteSpan piece) -> bool
+                {
+                    std::size_t first = tokens.size();
+                    EncodePiece(piece, tokens);
+                    if (tokens.size() > maxTokens)
+                    {
+                        tokens.resize(first);
+                        return false;
+                    }
+                    prefix.bytes = static_cast<std::size_t>(reinterpret_cast<const char*>(piece.data()) - utf8Text.data()) + piece.size();
+                    return true;
+                });
+            return prefix;
+        }
+
+        //the tail merge may take back the last pieces of the valid part, where a piece ends is
+        //only known once all of it is encoded
+        const std::size_t validLength = ValidUtf8Length(utf8Text);
+        std::vector<std::pair<std::size_t, std::size_t>> pieceEnds; //(byte, token) after every piece
+        std::size_t lastPiece = 0;
+        ForEachPiece(utf8Text.substr(0, validLength), [&](ByteSpan piece)
+            {
+                lastPiece = tokens.size();
+                EncodePiece(piece, tokens);
+                pieceEnds.emplace_back(static_cast<std::size_t>(reinterpret_cast<const char*>(piece.data()) - utf8Text.data()) + piece.size(), tokens.size());
+            });
+        const std::size_t stable = EncodeInvalidTail(utf8Text, validLength, 0, lastPiece, tokens);
+        if (tokens.size() <= maxTokens)
+        {
+            prefix.bytes = utf8Text.size();
+            return prefix;
         }
 
-        return std::nullopt;
+        if (stable <= maxTokens)
+        {
+            tokens.resize(stable);
+            prefix.bytes = DecodedLength(tokens);
+            return prefix;
+        }
+
+        auto fits = std::find_if(pieceEnds.rbegin(), pieceEnds.rend(), [maxTokens](const auto& end) { return end.second <= maxTokens; });
+        tokens.resize((fits == pieceEnds.rend()) ? 0 : fits->second);
+        prefix.bytes = (fits == pieceEnds.rend()) ? 0 : fits->first;
+
+        return prefix;
     }
 
-    std::vector<uint32_t> CoreBpe::EncodeNative(const std::string& utf8Text, const Utf8StringSet& allowedSpecial)
+    std::vector<uint32_t> CoreBpe::EncodeOrdinaryNative(const std::wstring& wideText) const
     {
+        static const std::vector<bool> NONE;
         std::vector<uint32_t> tokens;
-        
+        EncodeWide(wideText, NONE, NONE, tokens);
+
+        return tokens;
+    }
+
+    std::vector<uint32_t> CoreBpe::EncodeNative(std::string_view utf8Text, const std::vector<bool>& allowedSpecial) const
+    {
+        std::vector<uint32_t> tokens;
+        EncodeNativeInto(utf8Text, allowedSpecial, tokens);
+
+        return tokens;
+    }
+
+    template<typename PartFn, typename SpecialFn>
+    void CoreBpe::ForEachPart(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, PartFn&& onPart, SpecialFn&& onSpecial) const
+    {
+        //an empty mask allows nothing, there is nothing to scan for then
+        const bool anyAllowed = !allowedSpecial.empty();
+
+        //validated once, special tokens are valid UTF-8 so the parts between them are valid
+        //too. only text with invalid bytes looks for them again part by part
+        const bool validUtf8 = IsValidUtf8(utf8Text);
         std::size_t start = 0;
         while (true)
         {
-            Pcre2::CPcre2MatchData nextSpecial = m_SpecialRegex.CreateMatchDataFromPattern();
-            std::size_t startFind = start;
-            std::optional<std::tuple<std::size_t, std::size_t, std::string>> SpecialIdx = std::nullopt;
-            while (true)
-            {
-                int rc = m_SpecialRegex.Match(utf8Text, startFind, nextSpecial);
-                if (rc <= 0) 
-                    break;
+            std::optional<SpecialTokenMatch> special = anyAllowed ? m_specialScanner.FindFirst(utf8Text, start, allowedSpecial) : std::nullopt;
+            std::size_t end = special ? special->start : utf8Text.length();
 
-                Pcre2::CPcre2OVector overtor = nextSpecial.GetOVectorPointer();
-                SpecialIdx = FindFirstSpecialPosition(utf8Text, allowedSpecial, overtor);
-                if (SpecialIdx)
-                    break;
+            std::string_view part = utf8Text.substr(start, end - start);
+            onPart(part, validUtf8 || IsValidUtf8(part));
 
-                startFind = overtor.Last().start + 1;
+            if (!special)
+                break;
+
+            onSpecial(*special);
+            start = special->end;
+        }
+    }
+
+    void CoreBpe::EncodeNativeInto(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, std::vector<uint32_t>& tokens) const
+    {
+        ForEachPart(utf8Text, allowedSpecial,
+            [&](std::string_view part, bool validUtf8) { EncodeBytes(part, validUtf8, tokens); },
+            [&](const SpecialTokenMatch& special) { tokens.push_back(m_specialScanner.TokenId(special.index)); });
+    }
+
+    void CoreBpe::EncodeNativeChunked(std::string_view utf8Text, const std::vector<bool>& allowedSpecial,
+                                      std::size_t chunkTokens, const TokenSink& sink) const
+    {
+        //tokens wait in pending until there are chunkTokens of them. invalid UTF-8 takes back
+        //tokens of its part, such a part is given to the sink once it is encoded in full
+        chunkTokens = std::max<std::size_t>(chunkTokens, 1);
+        std::vector<uint32_t> pending;
+        pending.reserve(chunkTokens + LARGE_PIECE_THRESHOLD);
+        auto flush = [&](std::size_t least)
+        {
+            if (pending.size() >= least)
+            {
+                sink(std::span<const uint32_t>(pending));
+                pending.clear();
             }
-            std::size_t end = (SpecialIdx) ? std::get<0>(SpecialIdx.value()) : utf8Text.length();
+        };
 
-            std::vector<std::string> words = Utf8WordsSpliter(utf8Text.substr(start, end - start));
-            for (const auto& word : words)
+        ForEachPart(utf8Text, allowedSpecial,
+            [&](std::string_view part, bool validUtf8)
             {
-                std::vector<uint8_t> word_bytes = StringToBytes(word);
-                auto it = m_encoder->find(word_bytes);
-                if (it != m_encoder->end())
+                if (!validUtf8)
                 {
-                    tokens.push_back(it->second);
+                    EncodeBytes(part, false, pending);
+                    flush(chunkTokens);
+                    return;
                 }
-                else
+                ForEachPiece(part, [&](ByteSpan piece)
+                    {
+                        EncodePiece(piece, pending);
+                        flush(chunkTokens);
+                    });
+            },
+            [&](const SpecialTokenMatch& special)
+            {
+                pending.push_back(m_specialScanner.TokenId(special.index));
+                flush(chunkTokens);
+            });
+        flush(1);
+    }
+
+    std::size_t CoreBpe::EncodeNativeToSpan(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, std::span<uint32_t> buffer) const
+    {
+        //vocabulary hits go straight into buffer, other pieces are merged in the thread's scratch
+        std::vector<uint32_t>& merged = GetThreadScratch().spanTokens;
+        std::size_t count = 0;
+        auto put = [&](std::span<const uint32_t> tokens)
+        {
+            if (count < buffer.size())
+                std::copy_n(tokens.begin(), std::min(tokens.size(), buffer.size() - count), buffer.begin() + count);
+            count += tokens.size();
+        };
+
+        ForEachPart(utf8Text, allowedSpecial,
+            [&](std::string_view part, bool validUtf8)
+            {
+                if (!validUtf8)
                 {
-                    std::vector<uint32_t> word_tokens = BytePairEncode(word_bytes);
-                    std::move(word_tokens.begin(), word_tokens.end(), std::back_inserter(tokens));
+                    merged.clear();
+                    EncodeBytes(part, false, merged);
+                    put(merged);
+                    return;
                 }
-            }
+                ForEachPiece(part, [&](ByteSpan piece)
+                    {
+                        if (count >= buffer.size())
+                        {
+                            count += CountPiece(piece);
+                            return;
+                        }
+                        if (auto rank = m_encoder->Find(piece); rank.has_value())
+                        {
+                            buffer[count++] = *rank;
+                            return;
+                        }
+                        merged.clear();
+                        EncodePiece(piece, merged);
+                        put(merged);
+                    });
+            },
+            [&](const SpecialTokenMatch& special)
+            {
+                const uint32_t token = m_specialScanner.TokenId(special.index);
+                put(std::span<const uint32_t>(&token, 1));
+            });
+
+        return count;
+    }
+
+    std::size_t CoreBpe::CountOrdinaryNative(std::string_view utf8Text) const
+    {
+        return CountBytes(utf8Text, IsValidUtf8(utf8Text));
+    }
+
+    std::size_t CoreBpe::CountNative(std::string_view utf8Text, const std::vector<bool>& allowedSpecial) const
+    {
+        std::size_t count = 0;
+        ForEachPart(utf8Text, allowedSpecial,
+            [&](std::string_view part, bool validUtf8) { count += CountBytes(part, validUtf8); },
+            [&](const SpecialTokenMatch&) { count++; });
 
-            if (SpecialIdx)
+        return count;
+    }
+
+    //UTF-16 code units of the characters that start in text, a 4 byte sequence takes two
+    static std::size_t Utf16Length(std::string_view text)
+    {
+        std::size_t units = 0;
+        for (char c : text)
+        {
+            const uint8_t byte = static_cast<uint8_t>(c);
+            units += ((byte & 0xC0) != 0x80) + (byte >= 0xF0);
+        }
+
+        return units;
+    }
+
+    TokenOffsets CoreBpe::EncodeOrdinaryWithOffsets(std::string_view utf8Text, bool withUtf16) const
+    {
+        static const std::vector<bool> NONE;
+        return EncodeWithOffsets(utf8Text, NONE, withUtf16);
+    }
+
+    TokenOffsets CoreBpe::EncodeWithOffsets(std::string_view utf8Text, const std::vector<bool>& allowedSpecial, bool withUtf16) const
+    {
+        //tokens of a part cover its bytes one after another, the vocabulary gives their lengths
+        TokenOffsets result;
+        std::size_t bytePos = 0, utf16Pos = 0;
+        auto advance = [&](std::size_t length)
+        {
+            result.bytes.emplace_back(bytePos, bytePos + length);
+            if (withUtf16)
             {
-                tokens.push_back(m_specialTokensEncoder[std::get<2>(SpecialIdx.value())]);
-                start = std::get<1>(SpecialIdx.value());
+                std::size_t units = Utf16Length(utf8Text.substr(bytePos, length));
+                result.utf16.emplace_back(utf16Pos, utf16Pos + units);
+                utf16Pos += units;
             }
-            else
+            bytePos += length;
+        };
+
+        ForEachPart(utf8Text, allowedSpecial,
+            [&](std::string_view part, bool validUtf8)
             {
-                break;
-            }
-        }
+                std::size_t first = result.tokens.size();
+                EncodeBytes(part, validUtf8, result.tokens);
+                for (std::size_t i = first; i < result.tokens.size(); i++)
+                    advance(m_encoder->TokenBytes(result.tokens[i]).size());
+            },
+            [&](const SpecialTokenMatch& special)
+            {
+                result.tokens.push_back(m_specialScanner.TokenId(special.index));
+                advance(special.end - special.start);
+            });
 
-        return tokens;
+        return result;
     }
 
-    //todo: 
-    std::vector<uint32_t> CoreBpe::EncodeNative(const std::wstring& utf16Text, const Utf8StringSet& allowedSpecial)
+    std::vector<uint32_t> CoreBpe::EncodeNative(const std::wstring& wideText, const std::vector<bool>& allowedSpecial,
+                                                const std::vector<bool>& disallowedSpecial) const
     {
         std::vector<uint32_t> tokens;
+        EncodeWide(wideText, allowedSpecial, disallowedSpecial, tokens);
 
         return tokens;
     }
 
-    std::vector<std::string> CoreBpe::DecodeNative(const std::vector<uint32_t>& tokens)
+    void CoreBpe::EncodeWide(std::wstring_view wideText, const std::vector<bool>& allowedSpecial,
+                             const std::vector<bool>& disallowedSpecial, std::vector<uint32_t>& tokens) const
     {
-        if (m_decoder == nullptr)
-            m_decoder = InitDecodeDict();
+        //the UTF-8 of a chunk is appended to what is left of the chunks before. pieces and
+        //special tokens are taken from the front as soon as more text can not change them,
+        //the text they were found in is dropped. the transcoded text is always valid UTF-8
+        std::string& buffer = GetThreadScratch().wideChunk;
+        buffer.clear();
+        const bool anyAllowed = !allowedSpecial.empty();
+        const bool anyDisallowed = !disallowedSpecial.empty();
+        //a special token starting this close to the end of buffer may go on in the next chunk
+        const std::size_t specialMargin = ((anyAllowed || anyDisallowed) && (m_specialScanner.MaxLength() > 0)) ? m_specialScanner.MaxLength() - 1 : 0;
+        std::size_t consumed = 0;
+        while (true)
+        {
+            std::size_t chunkEnd = std::min(wideText.size(), consumed + WIDE_CHUNK_SIZE);
+            if ((sizeof(wchar_t) == 2) && (chunkEnd < wideText.size()) && (wideText[chunkEnd - 1] >= 0xD800) && (wideText[chunkEnd - 1] <= 0xDBFF))
+                chunkEnd++; //keep surrogate pairs together
+            AppendUTF8FromWide(wideText.substr(consumed, chunkEnd - consumed), buffer);
+            consumed = chunkEnd;
+            const bool atEnd = (consumed == wideText.size());
+            std::size_t limit = atEnd ? buffer.size() : buffer.size() - std::min(buffer.size(), specialMargin);
+
+            if (anyDisallowed)
+            {
+                std::optional<SpecialTokenMatch> special = m_specialScanner.FindFirst(buffer, 0, disallowedSpecial);
+                if (special && (special->start < limit))
+                    ThrowDisallowedSpecial();
+            }
+            while (anyAllowed)
+            {
+                std::optional<SpecialTokenMatch> special = m_specialScanner.FindFirst(buffer, 0, allowedSpecial);
+                if (!special || (special->start >= limit))
+                    break;
+
+                EncodeBytes(std::string_view(buffer).substr(0, special->start), true, tokens);
+                tokens.push_back(m_specialScanner.TokenId(special->index));
+                buffer.erase(0, special->end);
+                limit = (limit > special->end) ? limit - special->end : 0;
+            }
 
+            if (atEnd)
+            {
+                EncodeBytes(buffer, true, tokens);
+                return;
+            }
+
+            //a piece is final when the piece after it ends before limit: the last piece may grow
+            //with the next chunk, and the one before it may change where a special token cuts
+            //the text (a run of spaces before the end of text is one piece)
+            const uint8_t* base = reinterpret_cast<const uint8_t*>(buffer.data());
+            std::size_t encoded = 0;
+            std::optional<ByteSpan> pending;
+            bool stop = false;
+            ForEachPiece(buffer, [&](ByteSpan piece)
+                {
+                    if (stop)
+                        return;
+                    if (static_cast<std::size_t>(piece.data() + piece.size() - base) >= limit)
+                    {
+                        stop = true;
+                        return;
+                    }
+                    if (pending)
+                    {
+                        EncodePiece(*pending, tokens);
+                        encoded = pending->data() + pending->size() - base;
+                    }
+                    pending = piece;
+                });
+            buffer.erase(0, encoded);
+        }
+    }
+
+    std::vector<std::string> CoreBpe::DecodeNative(const std::vector<uint32_t>& tokens) const
+    {
         std::vector<std::string> words;
         words.reserve(tokens.size());
         for (const uint32_t& token : tokens)
         {
-            auto it = m_decoder->find(token);
-            if (it != m_decoder->end())
+            ByteSpan bytes = TokenBytes(token);
+            if (!bytes.empty())
             {
-                words.emplace_back(it->second);
-            }
-            else
-            {
-                auto specIt = m_specialTokensDecoder.find(token);
-                if (specIt != m_specialTokensDecoder.end())
-                {
-                    words.emplace_back(specIt->second);
-                }
+                words.emplace_back(bytes.begin(), bytes.end());
             }
         }
         
         return words;
     }
 
-    std::unique_ptr<decode_dict> CoreBpe::InitDecodeDict()
+    ByteSpan CoreBpe::TokenBytes(uint32_t token) const
+    {
+        ByteSpan bytes = m_encoder->TokenBytes(token);
+        if (bytes.empty())
+        {
+            auto specIt = m_specialTokensDecoder.find(token);
+            if (specIt != m_specialTokensDecoder.end())
+            {
+                bytes = ToByteSpan(specIt->second);
+            }
+        }
+
+        return bytes;
+    }
+
+    std::size_t CoreBpe::DecodedLength(std::span<const uint32_t> tokens) const
     {
-        auto ptr = std::make_unique<decode_dict>();
-        std::for_each(m_encoder->begin(), m_encoder->end(),
-            [&ptr](const auto& enc) { ptr->emplace(enc.second, BytesToString(enc.first)); });
+        std::size_t length = 0;
+        for (const uint32_t& token : tokens)
+        {
+            length += TokenBytes(token).size();
+        }
 
-        return ptr;
+        return length;
     }
 
-    std::vector<std::string> CoreBpe::Utf8WordsSpliter(const std::string& utf8Text)
+    std::size_t CoreBpe::DecodeInto(std::span<const uint32_t> tokens, std::span<char> buffer) const
     {
-        std::vector<std::string> tokens;
+        std::size_t length = DecodedLength(tokens);
+        if (length > buffer.size())
+            throw std::length_error("decode buffer is too small");
 
-        Pcre2::CPcre2MatchData matchData = m_Regex.CreateMatchDataFromPattern();
-        PCRE2_SIZE start_offset = 0;
-        int rc = m_Regex.Match(utf8Text, start_offset, matchData);
-        while (rc > 0)
+        char* out = buffer.data();
+        for (const uint32_t& token : tokens)
         {
-            Pcre2::CPcre2OVector overtor = matchData.GetOVectorPointer();
-            for (const auto& mat : overtor)
-            {
-                tokens.push_back(utf8Text.substr(mat.start, mat.end - mat.start));
-            }
-            start_offset = overtor.Last().end;
-            rc = m_Regex.Match(utf8Text, start_offset, matchData);
+            ByteSpan bytes = TokenBytes(token);
+            std::memcpy(out, bytes.data(), bytes.size());
+            out += bytes.size();
         }
 
-        return tokens;
+        return length;
+    }
+
+    void CoreBpe::DecodeBytes(std::span<const uint32_t> tokens, std::string& out) const
+    {
+        std::size_t start = out.size();
+        out.resize(start + DecodedLength(tokens));
+        DecodeInto(tokens, std::span<char>(out.data() + start, out.size() - start));
+    }
+
+    std::size_t CoreBpe::MemoryUsage() const
+    {
+        std::size_t usage = sizeof(CoreBpe) + m_encoder->MemoryUsage() + m_pieceCache.MemoryUsage() + m_specialScanner.MemoryUsage();
+        for (const auto& special : m_specialTokensEncoder)
+            usage += 2 * (sizeof(special) + special.first.capacity());
+
+        return usage;
     }
 
-    static std::vector<std::pair<size_t, size_t>> InitParts(std::size_t size)
+    static void InitParts(std::vector<std::pair<size_t, size_t>>& parts, std::size_t size)
     {
-        std::vector<std::pair<size_t, size_t>> parts;
+        parts.clear();
         for (std::size_t i = 0; i < size + 1; i++)
             parts.emplace_back(i, std::numeric_limits<size_t>::max());
+    }
 
-        return parts;
+    void CoreBpe::BytePairMerge(ByteSpan piece, std::function<uint32_t(std::pair<size_t, size_t>)> f, std::vector<uint32_t>& out) const
+    {
+        if (piece.size() >= LARGE_PIECE_THRESHOLD)
+            BytePairMergeLarge(piece, f, out);
+        else
+            BytePairMergeSmall(piece, f, out);
     }
 
-    std::vector<uint32_t> CoreBpe::BytePairMerge(const std::vector<uint8_t>& piece, std::function<uint32_t(std::pair<size_t, size_t>)> f)
+    void CoreBpe::BytePairMergeSmall(ByteSpan piece, std::function<uint32_t(std::pair<size_t, size_t>)> f, std::vector<uint32_t>& out) const
     {
-        std::vector<std::pair<size_t, size_t>> parts = InitParts(piece.size());
+        std::vector<std::pair<size_t, size_t>>& parts = GetThreadScratch().mergeParts;
+        InitParts(parts, piece.size());
 
         auto get_rank = [&](const std::vector<std::pair<size_t, size_t>>& parts, size_t start_idx, size_t skip) -> std::optional<size_t>
         {
             if (start_idx + skip + 2 < parts.size())
             {
-                auto it = m_encoder->find(std::vector<uint8_t>(piece.begin() + parts[start_idx].first, piece.begin() + parts[start_idx + skip + 2].first));
-                if (it != m_encoder->end())
+                auto rank = m_encoder->Find(piece.subspan(parts[start_idx].first, parts[start_idx + skip + 2].first - parts[start_idx].first));
+                if (rank.has_value())
                 {
-                    return it->second;
+                    return *rank;
                 }
             }
             return std::nullopt;
@@ -278,22 +722,158 @@ namespace TiktokenCpp
             }
         }
 
-        std::vector<uint32_t> out;
         for (size_t i = 0; i < parts.size() - 1; ++i)
         {
             out.push_back(f({ parts[i].first, parts[i + 1].first }));
         }
+    }
+
+    //O(n log n) merge for long pieces (base64 blobs, minified code, urls...).
+    //parts are kept in an intrusive doubly-linked list indexed by their start byte,
+    //candidate pairs live in a min-heap ordered by (rank, start), stale entries are
+    //skipped when popped. The merge order is the same as the linear scan above:
+    //lowest rank first, leftmost pair on ties.
+    void CoreBpe::BytePairMergeLarge(ByteSpan piece, std::function<uint32_t(std::pair<size_t, size_t>)> f, std::vector<uint32_t>& out) const
+    {
+        const std::size_t npos = std::numeric_limits<std::size_t>::max();
+        const std::size_t count = piece.size();
+
+        struct PartNode
+        {
+            std::size_t prev;
+            std::size_t next;  //start of next part, count for the last one
+            std::size_t rank;  //rank of this part merged with the next one
+        };
+        std::vector<PartNode> nodes(count);
+        for (std::size_t i = 0; i < count; i++)
+            nodes[i] = { (i == 0) ? npos : i - 1, i + 1, npos };
+
+        auto get_rank = [&](std::size_t start) -> std::size_t
+        {
+            std::size_t mid = nodes[start].next;
+            if (mid >= count)
+                return npos;
+
+            std::size_t end = nodes[mid].next;
+            auto rank = m_encoder->Find(piece.subspan(start, end - start));
+            return rank.has_value() ? *rank : npos;
+        };
+
+        using HeapItem = std::pair<std::size_t, std::size_t>; //(rank, start)
+        std::vector<HeapItem> heapStorage;
+        heapStorage.reserve(count);
+        for (std::size_t i = 0; i + 1 < count; i++)
+        {
+            nodes[i].rank = get_rank(i);
+            if (nodes[i].rank != npos)
+                heapStorage.emplace_back(nodes[i].rank, i);
+        }
+        std::priority_queue<HeapItem, std::vector<HeapItem>, std::greater<HeapItem>> heap(std::greater<HeapItem>(), std::move(heapStorage));
+
+        while (!heap.empty())
+        {
+            auto [rank, start] = heap.top();
+            heap.pop();
+            //stale entry: the part was merged away or its pair rank has changed
+            if ((nodes[start].rank != rank) || (nodes[start].next >= count))
+                continue;
+
+            std::size_t removed = nodes[start].next;
+            nodes[start].next = nodes[removed].next;
+            if (nodes[start].next < count)
+                nodes[nodes[start].next].prev = start;
+            nodes[removed].rank = npos;
+            nodes[removed].next = count; //never valid again
+
+            nodes[start].rank = get_rank(start);
+            if (nodes[start].rank != npos)
+                heap.emplace(nodes[start].rank, start);
+
+            std::size_t prev = nodes[start].prev;
+            if (prev != npos)
+            {
+                nodes[prev].rank = get_rank(prev);
+                if (nodes[prev].rank != npos)
+                    heap.emplace(nodes[prev].rank, prev);
+            }
+        }
 
-        return out;
+        for (std::size_t i = 0; i < count; i = nodes[i].next)
+        {
+            out.push_back(f({ i, nodes[i].next }));
+        }
     }
 
-    std::vector<uint32_t> CoreBpe::BytePairEncode(const std::vector<uint8_t>& piece)
+    void CoreBpe::BytePairEncode(ByteSpan piece, std::vector<uint32_t>& out) const
     {
         if (piece.size() == 1) {
-            return { m_encoder->at(piece) };
+            out.push_back(RankOf(piece));
+            return;
+        }
+
+        BytePairMerge(piece, [&](const std::pair<size_t, size_t>& p)
+            { return RankOf(piece.subspan(p.first, p.second - p.first)); }, out);
+    }
+
+    std::vector<uint32_t> CoreBpe::MergePiece(ByteSpan piece, bool largeMerge) const
+    {
+        std::vector<uint32_t> tokens;
+        if (piece.size() == 1)
+        {
+            tokens.push_back(RankOf(piece));
+            return tokens;
+        }
+
+        auto rankOf = [&](const std::pair<size_t, size_t>& p) { return RankOf(piece.subspan(p.first, p.second - p.first)); };
+        if (largeMerge)
+            BytePairMergeLarge(piece, rankOf, tokens);
+        else
+            BytePairMergeSmall(piece, rankOf, tokens);
+
+        return tokens;
+    }
+
+    void CoreBpe::EncodePiece(ByteSpan piece, std::vector<uint32_t>& tokens) const
+    {
+        auto rank = m_encoder->Find(piece);
+        if (rank.has_value())
+        {
+            tokens.push_back(*rank);
+            return;
         }
 
-        return BytePairMerge(piece, [&](const std::pair<size_t, size_t>& p)
-            { return m_encoder->at(std::vector<uint8_t>(piece.begin() + p.first, piece.begin() + p.second)); });
+        if (m_pieceCache.Lookup(piece, tokens))
+            return;
+
+        //merged straight into tokens, the new tail is what the cache keeps
+        std::size_t first = tokens.size();
+        BytePairEncode(piece, tokens);
+        m_pieceCache.Insert(piece, std::span<const uint32_t>(tokens).subspan(first));
+    }
+
+    std::size_t CoreBpe::CountPiece(ByteSpan piece) const
+    {
+        if (m_encoder->Find(piece).has_value())
+            return 1;
+
+        std::size_t count = 0;
+        if (m_pieceCache.LookupCount(piece, count))
+            return count;
+
+        std::vector<uint32_t>& merged = GetThreadScratch().countTokens;
+        merged.clear();
+        BytePairEncode(piece, merged);
+        m_pieceCache.Insert(piece, merged);
+
+        return merged.size();
+    }
+
+    uint32_t CoreBpe::RankOf(ByteSpan bytes) const
+    {
+        auto rank = m_encoder->Find(bytes);
+        if (!rank.has_value())
+            throw std::out_of_range("token bytes not in encoder");
+
+        return *rank;
     }
 }
@@ -0,0 +1,36 @@
+#include "embedded_encoding.h"
+
+namespace TiktokenCpp
+{
+#ifdef TIKTOKEN_EMBED_ENCODINGS
+    //defined by the generated embedded_encodings.cpp
+    extern const EmbeddedEncoding* const EMBEDDED_ENCODINGS[];
+    extern const std::size_t EMBEDDED_ENCODING_COUNT;
+#else
+    static const EmbeddedEncoding* const* EMBEDDED_ENCODINGS = nullptr;
+    static const std::size_t EMBEDDED_ENCODING_COUNT = 0;
+#endif
+
+    const EmbeddedEncoding* FindEmbeddedEncoding(const std::string_view& name)
+    {
+        for (std::size_t i = 0; i < EMBEDDED_ENCODING_COUNT; i++)
+        {
+            if (name == EMBEDDED_ENCODINGS[i]->name)
+                return EMBEDDED_ENCODINGS[i];
+        }
+
+        return nullptr;
+    }
+
+    std::unique_ptr<BpeVocab> LoadEmbeddedVocab(const EmbeddedEncoding& encoding)
+    {
+        auto vocab = std::make_unique<BpeVocab>();
+        vocab->Attach(ByteSpan(encoding.arena, encoding.arenaSize),
+            std::span<const uint32_t>(encoding.offsets, encoding.rankCount + 1),
+            std::span<const VocabSlot>(encoding.slots, encoding.tokenCount),
+            encoding.tokenCount, nullptr,
+            std::span<const uint32_t>(encoding.displacements, encoding.displacementCount));
+
+        return vocab;
+    }
+}
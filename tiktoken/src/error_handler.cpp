@@ -10,4 +10,16 @@ namespace TiktokenCpp
 
         throw std::runtime_error(errstr.c_str());
     }
+
+    void ThrowDisallowedSpecial()
+    {
+        const  char* ValueError = "Encountered text corresponding to disallowed special token {token!r}.\n"
+            "If you want this text to be encoded as a special token, "
+            "pass it to `allowed_special`, e.g. `allowed_special={{{token!r}, ...}}`.\n"
+            "If you want this text to be encoded as normal text, disable the check for this token "
+            "by passing `disallowed_special=(enc.special_tokens_set - {{{token!r}}})`.\n"
+            "To disable this check for all special tokens, pass `disallowed_special=()`.\n";
+
+        throw std::runtime_error(ValueError);
+    }
 }
@@ -0,0 +1,24 @@
+#include "pattern_dfa.h"
+
+namespace TiktokenCpp
+{
+#ifdef TIKTOKEN_PATTERN_DFA
+    //defined by the generated pattern_dfa_tables.cpp
+    extern const PatternDfa* const PATTERN_DFAS[];
+    extern const std::size_t PATTERN_DFA_COUNT;
+#else
+    static const PatternDfa* const* PATTERN_DFAS = nullptr;
+    static const std::size_t PATTERN_DFA_COUNT = 0;
+#endif
+
+    const PatternDfa* FindPatternDfa(std::string_view pattern)
+    {
+        for (std::size_t i = 0; i < PATTERN_DFA_COUNT; i++)
+        {
+            if (pattern == PATTERN_DFAS[i]->pattern)
+                return PATTERN_DFAS[i];
+        }
+
+        return nullptr;
+    }
+}
@@ -0,0 +1,181 @@
+#include <mutex>
+#include "bpe_vocab.h"
+#include "utils.h"
+#include "piece_cache.h"
+
+namespace TiktokenCpp
+{
+    std::size_t PieceCache::PieceHash::operator()(std::string_view piece) const
+    {
+        return static_cast<std::size_t>(VocabHashBytes(ToByteSpan(piece)));
+    }
+
+    PieceCache::PieceCache(std::size_t limit)
+    {
+        SetLimit(limit);
+    }
+
+    //bytes of the entry, its token array and its index node
+    std::size_t PieceCache::EntryCost(std::size_t pieceSize, std::size_t tokenCount)
+    {
+        return sizeof(CacheEntry) + pieceSize + tokenCount * sizeof(uint32_t) + 4 * sizeof(void*);
+    }
+
+    PieceCache::CacheShard& PieceCache::ShardOf(std::string_view piece)
+    {
+        //the top bits pick the shard, the index of the shard uses the low bits
+        return m_shards[VocabHashBytes(ToByteSpan(piece)) >> 60];
+    }
+
+    bool PieceCache::Lookup(ByteSpan piece, std::vector<uint32_t>& out)
+    {
+        if (!m_enabled.load(std::memory_order_relaxed))
+            return false;
+
+        std::string_view key(reinterpret_cast<const char*>(piece.data()), piece.size());
+        CacheShard& shard = ShardOf(key);
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end())
+            {
+                CacheEntry& entry = shard.entries[it->second];
+                entry.referenced.store(true, std::memory_order_relaxed);
+                out.insert(out.end(), entry.tokens.begin(), entry.tokens.end());
+                shard.hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+
+        return false;
+    }
+
+    bool PieceCache::LookupCount(ByteSpan piece, std::size_t& count)
+    {
+        if (!m_enabled.load(std::memory_order_relaxed))
+            return false;
+
+        std::string_view key(reinterpret_cast<const char*>(piece.data()), piece.size());
+        CacheShard& shard = ShardOf(key);
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.index.find(key);
+            if (it != shard.index.end())
+            {
+                CacheEntry& entry = shard.entries[it->second];
+                entry.referenced.store(true, std::memory_order_relaxed);
+                count = entry.tokens.size();
+                shard.hits.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+
+        return false;
+    }
+
+    void PieceCache::Insert(ByteSpan piece, std::span<const uint32_t> tokens)
+    {
+        if (!m_enabled.load(std::memory_order_relaxed) || (piece.size() > PIECE_CACHE_MAX_PIECE))
+            return;
+
+        std::string_view key(reinterpret_cast<const char*>(piece.data()), piece.size());
+        CacheShard& shard = ShardOf(key);
+        std::size_t cost = EntryCost(piece.size(), tokens.size());
+
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        if ((cost > shard.limit) || shard.index.contains(key)) //another thread was faster
+            return;
+
+        MakeRoom(shard, cost);
+
+        uint32_t slot = 0;
+        if (!shard.freeEntries.empty())
+        {
+            slot = shard.freeEntries.back();
+            shard.freeEntries.pop_back();
+        }
+        else
+        {
+            slot = static_cast<uint32_t>(shard.entries.size());
+            shard.entries.emplace_back();
+        }
+
+        CacheEntry& entry = shard.entries[slot];
+        entry.piece.assign(key);
+        entry.tokens.assign(tokens.begin(), tokens.end());
+        entry.referenced.store(false, std::memory_order_relaxed);
+        shard.index.emplace(entry.piece, slot);
+        shard.memory += cost;
+    }
+
+    void PieceCache::MakeRoom(CacheShard& shard, std::size_t extra)
+    {
+        while ((shard.memory + extra > shard.limit) && !shard.index.empty())
+        {
+            if (shard.hand >= shard.entries.size())
+                shard.hand = 0;
+
+            CacheEntry& entry = shard.entries[shard.hand];
+            if (!entry.piece.empty())
+            {
+                //second chance for entries used since the hand passed them last time
+                if (entry.referenced.exchange(false, std::memory_order_relaxed) == false)
+                {
+                    shard.index.erase(entry.piece);
+                    shard.memory -= EntryCost(entry.piece.size(), entry.tokens.size());
+                    entry.piece.clear();
+                    entry.tokens.clear();
+                    shard.freeEntries.push_back(static_cast<uint32_t>(shard.hand));
+                }
+            }
+            shard.hand++;
+        }
+    }
+
+    void PieceCache::SetLimit(std::size_t limit)
+    {
+        m_enabled.store(limit != 0, std::memory_order_relaxed);
+        for (CacheShard& shard : m_shards)
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.limit = limit / PIECE_CACHE_SHARDS;
+            MakeRoom(shard, 0);
+            if (limit == 0)
+            {
+                shard.entries.clear();
+                shard.freeEntries.clear();
+                shard.hand = 0;
+            }
+        }
+    }
+
+    PieceCacheStats PieceCache::GetStats() const
+    {
+        PieceCacheStats stats;
+        for (const CacheShard& shard : m_shards)
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            stats.hits += shard.hits.load(std::memory_order_relaxed);
+            stats.misses += shard.misses.load(std::memory_order_relaxed);
+            stats.entries += shard.index.size();
+            stats.memory += shard.memory;
+            stats.limit += shard.limit;
+        }
+
+        return stats;
+    }
+
+    std::size_t PieceCache::MemoryUsage() const
+    {
+        std::size_t usage = sizeof(PieceCache);
+        for (const CacheShard& shard : m_shards)
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            usage += shard.memory;
+        }
+
+        return usage;
+    }
+}
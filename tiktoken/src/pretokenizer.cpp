@@ -0,0 +1,644 @@
+#include <bit>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+    #include <emmintrin.h>
+    #define TIKTOKEN_USE_SSE2
+#endif
+#if defined(__SSSE3__) || defined(__AVX__)
+    #include <tmmintrin.h>
+    #define TIKTOKEN_USE_SSSE3
+#endif
+#include <algorithm>
+#include "registry.h"
+#include "unicode_tables.h"
+#include "pattern_dfa.h"
+#include "pcre2cpp.h"
+#include "pretokenizer.h"
+
+namespace TiktokenCpp
+{
+    //same classes as the generated table, ASCII is the common case of every scanner loop
+    static constexpr CharClass AsciiClass(uint8_t c)
+    {
+        if (((c | 0x20) >= 'a') && ((c | 0x20) <= 'z'))
+            return CharClass::Letter;
+        if ((c >= '0') && (c <= '9'))
+            return CharClass::Number;
+        if ((c == ' ') || ((c >= 0x09) && (c <= 0x0D)))
+            return CharClass::Space;
+
+        return CharClass::Other;
+    }
+
+    struct CodePointClass
+    {
+        CharClass cls;
+        std::size_t length; //bytes of the code point
+    };
+
+    //class of the code point at pos, text is valid UTF-8
+    static inline CodePointClass ClassAt(const uint8_t* s, std::size_t pos)
+    {
+        uint8_t c = s[pos];
+        if (c < 0x80)
+            return { AsciiClass(c), 1 };
+        if (c < 0xE0)
+            return { GetCharClass(((c & 0x1Fu) << 6) | (s[pos + 1] & 0x3Fu)), 2 };
+        if (c < 0xF0)
+            return { GetCharClass(((c & 0x0Fu) << 12) | ((s[pos + 1] & 0x3Fu) << 6) | (s[pos + 2] & 0x3Fu)), 3 };
+
+        return { GetCharClass(((c & 0x07u) << 18) | ((s[pos + 1] & 0x3Fu) << 12) | ((s[pos + 2] & 0x3Fu) << 6) | (s[pos + 3] & 0x3Fu)), 4 };
+    }
+
+#ifdef TIKTOKEN_USE_SSE2
+    //bytes of v in [lo, hi], signed compare after moving lo to -128
+    static inline __m128i BytesInRange(__m128i v, uint8_t lo, uint8_t hi)
+    {
+        __m128i shifted = _mm_add_epi8(v, _mm_set1_epi8(static_cast<char>(0x80 - lo)));
+        return _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(0x80 + (hi - lo + 1))));
+    }
+
+    template<CharClass cls>
+    static inline __m128i AsciiClassMask(__m128i v)
+    {
+        __m128i letters = BytesInRange(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+        __m128i numbers = BytesInRange(v, '0', '9');
+        __m128i spaces = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), BytesInRange(v, 0x09, 0x0D));
+        if constexpr (cls == CharClass::Letter)
+            return letters;
+        else if constexpr (cls == CharClass::Number)
+            return numbers;
+        else if constexpr (cls == CharClass::Space)
+            return spaces;
+        else //ASCII bytes in none of the other classes, non-ASCII bytes are negative
+            return _mm_andnot_si128(_mm_or_si128(_mm_or_si128(letters, numbers), _mm_or_si128(spaces, _mm_cmplt_epi8(v, _mm_setzero_si128()))),
+                                    _mm_set1_epi8(-1));
+    }
+#endif
+
+    //skip ASCII bytes of class cls, stop at the first other byte (any non-ASCII byte too)
+    template<CharClass cls>
+    static inline std::size_t SkipAscii(const uint8_t* s, std::size_t pos, std::size_t end)
+    {
+#ifdef TIKTOKEN_USE_SSE2
+        while (pos + 16 <= end)
+        {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(AsciiClassMask<cls>(v)));
+            if (mask != 0xFFFF)
+                return pos + std::countr_one(mask);
+            pos += 16;
+        }
+#endif
+        while ((pos < end) && (s[pos] < 0x80) && (AsciiClass(s[pos]) == cls))
+            pos++;
+
+        return pos;
+    }
+
+    //skip code points of class cls
+    template<CharClass cls>
+    static std::size_t SkipRun(const uint8_t* s, std::size_t pos, std::size_t end)
+    {
+        while (pos < end)
+        {
+            pos = SkipAscii<cls>(s, pos, end);
+            if ((pos >= end) || (s[pos] < 0x80))
+                break;
+
+            CodePointClass cp = ClassAt(s, pos);
+            if (cp.cls != cls)
+                break;
+            pos += cp.length;
+        }
+
+        return pos;
+    }
+
+    struct SpaceRun
+    {
+        std::size_t end;
+        std::size_t lastStart;  //start of the last whitespace code point
+        std::size_t newlineEnd; //end of the last '\r' or '\n', 0 if there is none
+    };
+
+    static SpaceRun ScanSpaces(const uint8_t* s, std::size_t pos, std::size_t end)
+    {
+        SpaceRun run{ pos, pos, 0 };
+        while (run.end < end)
+        {
+            std::size_t ascii = SkipAscii<CharClass::Space>(s, run.end, end);
+            if (ascii > run.end)
+            {
+                run.lastStart = ascii - 1;
+                for (std::size_t i = ascii; i > run.end; i--)
+                {
+                    if ((s[i - 1] == '\r') || (s[i - 1] == '\n'))
+                    {
+                        run.newlineEnd = i;
+                        break;
+                    }
+                }
+                run.end = ascii;
+                continue;
+            }
+            if (s[run.end] < 0x80)
+                break;
+
+            CodePointClass cp = ClassAt(s, run.end);
+            if (cp.cls != CharClass::Space)
+                break;
+            run.lastStart = run.end;
+            run.end += cp.length;
+        }
+
+        return run;
+    }
+
+    //\s+(?!\S)|\s+ : when a non-space follows, the last whitespace code point is left to the next piece
+    static inline std::size_t SpacePiece(const SpaceRun& run, std::size_t pos, std::size_t end)
+    {
+        if ((run.end < end) && (run.lastStart > pos))
+            return run.lastStart;
+
+        return run.end;
+    }
+
+    //'s|'t|'re|'ve|'m|'ll|'d, return end of the contraction or 0.
+    //caseless matching follows PCRE2: only ASCII case pairs, plus U+017F (long s) for 's'
+    static std::size_t MatchContraction(const uint8_t* s, std::size_t pos, std::size_t end, bool caseless)
+    {
+        if ((s[pos] != '\'') || (pos + 1 >= end))
+            return 0;
+
+        auto fold = [caseless](uint8_t c) -> uint8_t { return (caseless && (c >= 'A') && (c <= 'Z')) ? (c | 0x20) : c; };
+        uint8_t first = fold(s[pos + 1]);
+        if ((first == 's') || (first == 't') || (first == 'm') || (first == 'd'))
+            return pos + 2;
+        if (caseless && (s[pos + 1] == 0xC5) && (pos + 2 < end) && (s[pos + 2] == 0xBF))
+            return pos + 3;
+        if (pos + 2 >= end)
+            return 0;
+
+        uint8_t second = fold(s[pos + 2]);
+        if ((first == 'r' && second == 'e') || (first == 'v' && second == 'e') || (first == 'l' && second == 'l'))
+            return pos + 3;
+
+        return 0;
+    }
+
+    //'s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+
+    class R50kPretokenizer final : public Pretokenizer
+    {
+    public:
+        std::size_t NextPiece(std::string_view text, std::size_t pos) const override
+        {
+            const uint8_t* s = reinterpret_cast<const uint8_t*>(text.data());
+            const std::size_t end = text.size();
+            if (std::size_t contraction = MatchContraction(s, pos, end, false))
+                return contraction;
+
+            //optional leading space of the letter, number and other runs
+            std::size_t start = pos;
+            CodePointClass cp = ClassAt(s, pos);
+            if ((s[pos] == ' ') && (pos + 1 < end))
+            {
+                CodePointClass next = ClassAt(s, pos + 1);
+                if (next.cls != CharClass::Space)
+                {
+                    start = pos + 1;
+                    cp = next;
+                }
+            }
+
+            switch (cp.cls)
+            {
+            case CharClass::Letter:
+                return SkipRun<CharClass::Letter>(s, start + cp.length, end);
+            case CharClass::Number:
+                return SkipRun<CharClass::Number>(s, start + cp.length, end);
+            case CharClass::Other:
+                return SkipRun<CharClass::Other>(s, start + cp.length, end);
+            default:
+                return SpacePiece(ScanSpaces(s, pos, end), pos, end);
+            }
+        }
+    };
+
+    //(?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+
+    class Cl100kPretokenizer final : public Pretokenizer
+    {
+    public:
+        std::size_t NextPiece(std::string_view text, std::size_t pos) const override
+        {
+            const uint8_t* s = reinterpret_cast<const uint8_t*>(text.data());
+            const std::size_t end = text.size();
+            if (std::size_t contraction = MatchContraction(s, pos, end, true))
+                return contraction;
+
+            //[^\r\n\p{L}\p{N}]?\p{L}+
+            CodePointClass cp = ClassAt(s, pos);
+            if (cp.cls == CharClass::Letter)
+                return SkipRun<CharClass::Letter>(s, pos + cp.length, end);
+            if ((cp.cls != CharClass::Number) && (s[pos] != '\r') && (s[pos] != '\n') && (pos + cp.length < end))
+            {
+                CodePointClass next = ClassAt(s, pos + cp.length);
+                if (next.cls == CharClass::Letter)
+                    return SkipRun<CharClass::Letter>(s, pos + cp.length + next.length, end);
+            }
+
+            //\p{N}{1,3}
+            if (cp.cls == CharClass::Number)
+            {
+                std::size_t p = pos + cp.length;
+                for (int i = 1; (i < 3) && (p < end); i++)
+                {
+                    CodePointClass next = ClassAt(s, p);
+                    if (next.cls != CharClass::Number)
+                        break;
+                    p += next.length;
+                }
+                return p;
+            }
+
+            // ?[^\s\p{L}\p{N}]+[\r\n]*
+            std::size_t start = pos;
+            if ((s[pos] == ' ') && (pos + 1 < end))
+            {
+                CodePointClass next = ClassAt(s, pos + 1);
+                if (next.cls == CharClass::Other)
+                {
+                    start = pos + 1;
+                    cp = next;
+                }
+            }
+            if (cp.cls == CharClass::Other)
+            {
+                std::size_t p = SkipRun<CharClass::Other>(s, start + cp.length, end);
+                while ((p < end) && ((s[p] == '\r') || (s[p] == '\n')))
+                    p++;
+                return p;
+            }
+
+            //\s*[\r\n]+ ends after the last newline of the whitespace run
+            SpaceRun run = ScanSpaces(s, pos, end);
+            if (run.newlineEnd != 0)
+                return run.newlineEnd;
+
+            return SpacePiece(run, pos, end);
+        }
+    };
+
+    //runs a PatternDfa, one table lookup per code point
+    class DfaPretokenizer final : public Pretokenizer
+    {
+    public:
+        explicit DfaPretokenizer(const PatternDfa& dfa) : m_dfa(dfa) {}
+
+        std::size_t NextPiece(std::string_view text, std::size_t pos) const override
+        {
+            const uint8_t* s = reinterpret_cast<const uint8_t*>(text.data());
+            const std::size_t end = text.size();
+            const uint16_t* transitions = m_dfa.transitions;
+            const uint32_t symbolCount = m_dfa.symbolCount;
+
+            //the start state can not match the empty string, lastMatch == start means no match
+            std::size_t lastMatch = pos;
+            uint32_t state = PATTERN_DFA_START_STATE;
+            while (pos < end)
+            {
+                uint8_t c = s[pos];
+                uint32_t symbol;
+                std::size_t length = 1;
+                if (c < 0x80)
+                    symbol = m_dfa.asciiSymbols[c];
+                else
+                {
+                    uint32_t cp;
+                    if (c < 0xE0)
+                    {
+                        cp = ((c & 0x1Fu) << 6) | (s[pos + 1] & 0x3Fu);
+                        length = 2;
+                    }
+                    else if (c < 0xF0)
+                    {
+                        cp = ((c & 0x0Fu) << 12) | ((s[pos + 1] & 0x3Fu) << 6) | (s[pos + 2] & 0x3Fu);
+                        length = 3;
+                    }
+                    else
+                    {
+                        cp = ((c & 0x07u) << 18) | ((s[pos + 1] & 0x3Fu) << 12) | ((s[pos + 2] & 0x3Fu) << 6) | (s[pos + 3] & 0x3Fu);
+                        length = 4;
+                    }
+                    symbol = SymbolOf(cp);
+                }
+
+                uint16_t next = transitions[state * symbolCount + symbol];
+                if (next & PATTERN_DFA_MATCH)
+                    lastMatch = pos;
+                state = next & ~PATTERN_DFA_MATCH;
+                if (state == PATTERN_DFA_DEAD_STATE)
+                    return lastMatch;
+                pos += length;
+            }
+
+            if (transitions[state * symbolCount + symbolCount - 1] & PATTERN_DFA_MATCH)
+                lastMatch = end;
+
+            return lastMatch;
+        }
+
+    private:
+        uint32_t SymbolOf(uint32_t cp) const
+        {
+            const uint32_t* first = m_dfa.extraCodePoints;
+            const uint32_t* last = first + m_dfa.extraCount;
+            const uint32_t* it = std::lower_bound(first, last, cp);
+            if ((it != last) && (*it == cp))
+                return m_dfa.extraSymbols[it - first];
+
+            return m_dfa.classSymbols[static_cast<uint8_t>(GetCharClass(cp))];
+        }
+
+        const PatternDfa& m_dfa;
+    };
+
+    struct RegexScratch
+    {
+        RegexScratch() { matchContext.AssignJitStack(jitStack); }
+
+        Pcre2::CPcre2MatchData matchData{ 4 };
+        Pcre2::CPcre2JitStack jitStack;
+        Pcre2::CPcre2MatchContext matchContext{ true };
+    };
+
+    class RegexPretokenizer final : public Pretokenizer
+    {
+    public:
+        RegexPretokenizer(std::string_view pattern, bool jit) : m_regex(std::string(pattern))
+        {
+            if (jit)
+                m_regex.JitCompile();
+        }
+
+        std::size_t NextPiece(std::string_view text, std::size_t pos) const override
+        {
+            //unanchored, JIT matching does not support PCRE2_ANCHORED at match time. the
+            //leftmost match starts at pos if the pattern matches there at all
+            static thread_local RegexScratch scratch;
+            if (m_regex.FastMatch(text, pos, scratch.matchData, PCRE2_NO_UTF_CHECK, scratch.matchContext) <= 0)
+                return pos;
+
+            const PCRE2_SIZE* ovector = scratch.matchData.GetRawOVector();
+            return (ovector[0] == pos) ? ovector[1] : pos;
+        }
+
+    private:
+        Pcre2::CPcre2Regex<char> m_regex;
+    };
+
+    std::unique_ptr<const Pretokenizer> CreatePretokenizer(std::string_view pattern)
+    {
+        std::unique_ptr<const Pretokenizer> pretokenizer = CreateHandWrittenPretokenizer(pattern);
+        if (pretokenizer == nullptr)
+            pretokenizer = CreateGeneratedPretokenizer(pattern);
+
+        return pretokenizer;
+    }
+
+    std::unique_ptr<const Pretokenizer> CreateHandWrittenPretokenizer(std::string_view pattern)
+    {
+        if (pattern == R50K_PAT_STR)
+            return std::make_unique<R50kPretokenizer>();
+        if (pattern == CL100K_PAT_STR)
+            return std::make_unique<Cl100kPretokenizer>();
+
+        return nullptr;
+    }
+
+    bool HasResyncPoints(std::string_view pattern)
+    {
+        //the piece with text[p - 2] stops at the newline or takes it as its [\r\n]* tail (cl100k).
+        //a newline before a letter is no \s+(?!\S) match, no letter prefix takes '\n' either
+        return (pattern == R50K_PAT_STR) || (pattern == CL100K_PAT_STR);
+    }
+
+    std::size_t FindResyncPoint(std::string_view text, std::size_t from)
+    {
+        auto isLetter = [](char c) { return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z')); };
+        for (std::size_t p = std::max<std::size_t>(from, 2); p < text.size(); p++)
+        {
+            std::size_t newline = text.find('\n', p - 1);
+            if ((newline == std::string_view::npos) || (newline + 1 >= text.size()))
+                break;
+
+            p = newline + 1;
+            if ((p >= 2) && (text[p - 2] > ' ') && (text[p - 2] < 0x7F) && isLetter(text[p]))
+                return p;
+        }
+
+        return std::string_view::npos;
+    }
+
+    std::unique_ptr<const Pretokenizer> CreateGeneratedPretokenizer(std::string_view pattern)
+    {
+        const PatternDfa* dfa = FindPatternDfa(pattern);
+        if (dfa == nullptr)
+            return nullptr;
+
+        return std::make_unique<DfaPretokenizer>(*dfa);
+    }
+
+    std::unique_ptr<const Pretokenizer> CreateRegexPretokenizer(std::string_view pattern, bool jit)
+    {
+        return std::make_unique<RegexPretokenizer>(pattern, jit);
+    }
+
+    std::size_t ValidUtf8Length(std::string_view text)
+    {
+        static const uint32_t MIN_CODE_POINT[5] = { 0, 0, 0x80, 0x800, 0x10000 }; //shorter forms are overlong
+
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(text.data());
+        const std::size_t end = text.size();
+        std::size_t pos = 0;
+        while (pos < end)
+        {
+#ifdef TIKTOKEN_USE_SSE2
+            while ((pos + 16 <= end) && (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos))) == 0))
+                pos += 16;
+            if (pos >= end)
+                break;
+#endif
+            uint8_t c = s[pos];
+            if (c < 0x80)
+            {
+                pos++;
+                continue;
+            }
+
+            std::size_t length = 0;
+            if ((c & 0xE0) == 0xC0)
+                length = 2;
+            else if ((c & 0xF0) == 0xE0)
+                length = 3;
+            else if ((c & 0xF8) == 0xF0)
+                length = 4;
+            else
+                return pos;
+            if (pos + length > end)
+                return pos;
+
+            uint32_t cp = c & (0x7Fu >> length);
+            for (std::size_t i = 1; i < length; i++)
+            {
+                if ((s[pos + i] & 0xC0) != 0x80)
+                    return pos;
+                cp = (cp << 6) | (s[pos + i] & 0x3Fu);
+            }
+            if ((cp < MIN_CODE_POINT[length]) || (cp > 0x10FFFF) || ((cp >= 0xD800) && (cp <= 0xDFFF)))
+                return pos;
+            pos += length;
+        }
+
+        return end;
+    }
+
+#ifdef TIKTOKEN_USE_SSSE3
+    //Keiser and Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte": the high and
+    //low nibble of every byte and the high nibble of the byte after it index three tables whose
+    //AND is non zero for every invalid pair of bytes, 3 and 4 byte sequences are checked by
+    //looking 2 and 3 bytes back. one vector of error bits is collected over the whole text
+    namespace
+    {
+        constexpr uint8_t TOO_SHORT = 1 << 0;      //lead byte or ASCII followed by a lead byte or ASCII
+        constexpr uint8_t TOO_LONG = 1 << 1;       //ASCII followed by a continuation byte
+        constexpr uint8_t OVERLONG_3 = 1 << 2;     //11100000 100_____
+        constexpr uint8_t TOO_LARGE = 1 << 3;      //11110100 1001____ and above
+        constexpr uint8_t SURROGATE = 1 << 4;      //11101101 101_____
+        constexpr uint8_t OVERLONG_2 = 1 << 5;     //1100000_ 10______
+        constexpr uint8_t TOO_LARGE_1000 = 1 << 6; //11110101 1000____ and above
+        constexpr uint8_t OVERLONG_4 = 1 << 6;     //11110000 1000____
+        constexpr uint8_t TWO_CONTS = 1 << 7;      //continuation byte followed by a continuation byte
+        constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+        inline __m128i Table(uint8_t b0, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4, uint8_t b5, uint8_t b6, uint8_t b7,
+            uint8_t b8, uint8_t b9, uint8_t b10, uint8_t b11, uint8_t b12, uint8_t b13, uint8_t b14, uint8_t b15)
+        {
+            return _mm_setr_epi8(char(b0), char(b1), char(b2), char(b3), char(b4), char(b5), char(b6), char(b7),
+                char(b8), char(b9), char(b10), char(b11), char(b12), char(b13), char(b14), char(b15));
+        }
+
+        class Utf8Checker
+        {
+        public:
+            void Check(__m128i input)
+            {
+                if (_mm_movemask_epi8(input) == 0)
+                {
+                    //ASCII block, only an unfinished sequence of the block before can be wrong
+                    m_error = _mm_or_si128(m_error, m_prevIncomplete);
+                }
+                else
+                {
+                    __m128i prev1 = _mm_alignr_epi8(input, m_prevInput, 15);
+                    __m128i special = SpecialCases(input, prev1);
+                    m_error = _mm_or_si128(m_error, MultibyteLengths(input, special));
+                    //a 4, 3 or 2 byte lead in the last 3, 2 or 1 bytes needs the next block
+                    const __m128i maxValue = Table(255, 255, 255, 255, 255, 255, 255, 255,
+                        255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1);
+                    m_prevIncomplete = _mm_subs_epu8(input, maxValue);
+                }
+                m_prevInput = input;
+            }
+            bool Finish() const
+            {
+                __m128i error = _mm_or_si128(m_error, m_prevIncomplete);
+                return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+            }
+
+        private:
+            static __m128i HighNibbles(__m128i v)
+            {
+                return _mm_and_si128(_mm_srli_epi16(v, 4), _mm_set1_epi8(0x0F));
+            }
+            static __m128i SpecialCases(__m128i input, __m128i prev1)
+            {
+                const __m128i byte1HighTable = Table(
+                    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                    TOO_SHORT | OVERLONG_2,
+                    TOO_SHORT,
+                    TOO_SHORT | OVERLONG_3 | SURROGATE,
+                    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+                const __m128i byte1LowTable = Table(
+                    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                    CARRY | OVERLONG_2,
+                    CARRY,
+                    CARRY,
+                    CARRY | TOO_LARGE,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000,
+                    CARRY | TOO_LARGE | TOO_LARGE_1000);
+                const __m128i byte2HighTable = Table(
+                    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+                    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+
+                __m128i byte1High = _mm_shuffle_epi8(byte1HighTable, HighNibbles(prev1));
+                __m128i byte1Low = _mm_shuffle_epi8(byte1LowTable, _mm_and_si128(prev1, _mm_set1_epi8(0x0F)));
+                __m128i byte2High = _mm_shuffle_epi8(byte2HighTable, HighNibbles(input));
+                return _mm_and_si128(_mm_and_si128(byte1High, byte1Low), byte2High);
+            }
+            __m128i MultibyteLengths(__m128i input, __m128i special) const
+            {
+                //the 2nd and 3rd byte after a 3 or 4 byte lead must be continuation bytes,
+                //they are the only continuations the tables above mark as TWO_CONTS
+                __m128i prev2 = _mm_alignr_epi8(input, m_prevInput, 14);
+                __m128i prev3 = _mm_alignr_epi8(input, m_prevInput, 13);
+                __m128i isThirdByte = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));  //bit 7 set if prev2 >= 0xE0
+                __m128i isFourthByte = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80)); //bit 7 set if prev3 >= 0xF0
+                __m128i must23 = _mm_and_si128(_mm_or_si128(isThirdByte, isFourthByte), _mm_set1_epi8(char(0x80)));
+                return _mm_xor_si128(must23, special);
+            }
+
+            __m128i m_error = _mm_setzero_si128();
+            __m128i m_prevInput = _mm_setzero_si128();
+            __m128i m_prevIncomplete = _mm_setzero_si128();
+        };
+    }
+
+    bool IsValidUtf8(std::string_view text)
+    {
+        const char* s = text.data();
+        const std::size_t end = text.size();
+        Utf8Checker checker;
+        std::size_t pos = 0;
+        for (; pos + 16 <= end; pos += 16)
+            checker.Check(_mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos)));
+        if (pos < end)
+        {
+            //zero padding is ASCII, a sequence cut by the end of text shows as TOO_SHORT
+            alignas(16) char last[16] = {};
+            std::copy(s + pos, s + end, last);
+            checker.Check(_mm_load_si128(reinterpret_cast<const __m128i*>(last)));
+        }
+
+        return checker.Finish();
+    }
+#else
+    bool IsValidUtf8(std::string_view text)
+    {
+        return ValidUtf8Length(text) == text.size();
+    }
+#endif
+}
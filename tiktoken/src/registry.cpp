@@ -22,29 +22,32 @@ namespace TiktokenCpp
     const char* const FIM_SUFFIX = "<|fim_suffix|>";
     const char* const ENDOFPROMPT = "<|endofprompt|>";
 
+    const char* const R50K_PAT_STR = R"---('s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+)---";
+    const char* const CL100K_PAT_STR = R"---((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+)---";
+
     static EncodingParam s_encoding_param[] =
     {
         {
             "r50k_base", 50257,
-            R"---('s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+)---",
+            R50K_PAT_STR,
             "https://openaipublic.blob.core.windows.net/encodings/r50k_base.tiktoken",
             {{ENDOFTEXT, 50256}}
         },
         {
             "p50k_base", 50281,
-            R"---('s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+)---",
+            R50K_PAT_STR,
             "https://openaipublic.blob.core.windows.net/encodings/p50k_base.tiktoken",
             {{ENDOFTEXT, 50256}}
         },
         {
             "p50k_edit", std::nullopt,
-            R"---('s|'t|'re|'ve|'m|'ll|'d| ?\p{L}+| ?\p{N}+| ?[^\s\p{L}\p{N}]+|\s+(?!\S)|\s+)---",
+            R50K_PAT_STR,
             "https://openaipublic.blob.core.windows.net/encodings/p50k_base.tiktoken",
             {{ENDOFTEXT, 50256}, {FIM_PREFIX, 50281}, {FIM_MIDDLE, 50282}, {FIM_SUFFIX, 50283}}
         },
         {
             "cl100k_base", std::nullopt,
-            R"---((?i:'s|'t|'re|'ve|'m|'ll|'d)|[^\r\n\p{L}\p{N}]?\p{L}+|\p{N}{1,3}| ?[^\s\p{L}\p{N}]+[\r\n]*|\s*[\r\n]+|\s+(?!\S)|\s+)---",
+            CL100K_PAT_STR,
             "https://openaipublic.blob.core.windows.net/encodings/cl100k_base.tiktoken",
             {{ENDOFTEXT, 100257}, {FIM_PREFIX, 100258}, {FIM_MIDDLE, 100259}, {FIM_SUFFIX, 100260}, {ENDOFPROMPT, 100276}}
         },
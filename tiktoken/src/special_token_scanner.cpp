@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "special_token_scanner.h"
+
+namespace TiktokenCpp
+{
+    SpecialTokenScanner::SpecialTokenScanner(const Utf8StrToInt& tokens)
+    {
+        std::vector<std::pair<std::string, uint32_t>> sorted;
+        for (const auto& [token, id] : tokens)
+        {
+            if (!token.empty())
+                sorted.emplace_back(token, id);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        for (auto& [token, id] : sorted)
+        {
+            m_tokens.push_back(std::move(token));
+            m_ids.push_back(id);
+        }
+        if (m_tokens.empty())
+            return;
+
+        m_minLength = std::numeric_limits<std::size_t>::max();
+        m_firstByte = static_cast<uint8_t>(m_tokens[0][0]);
+        for (const auto& token : m_tokens)
+        {
+            m_minLength = std::min(m_minLength, token.size());
+            m_maxLength = std::max(m_maxLength, token.size());
+            if (static_cast<uint8_t>(token[0]) != m_firstByte)
+                m_firstByte = -1;
+            for (char c : token)
+            {
+                uint16_t& cls = m_byteClasses[static_cast<uint8_t>(c)];
+                if (cls == 0)
+                    cls = static_cast<uint16_t>(m_classCount++);
+            }
+        }
+
+        //trie, missing edges are NONE until the breadth first pass below fills them in
+        const uint32_t NONE = std::numeric_limits<uint32_t>::max();
+        m_transitions.assign(m_classCount, NONE);
+        m_outputs.assign(1, -1);
+        for (uint32_t index = 0; index < m_tokens.size(); index++)
+        {
+            uint32_t state = 0;
+            for (char c : m_tokens[index])
+            {
+                uint32_t& next = m_transitions[state * m_classCount + m_byteClasses[static_cast<uint8_t>(c)]];
+                if (next == NONE)
+                {
+                    next = static_cast<uint32_t>(m_outputs.size());
+                    m_outputs.push_back(-1);
+                    m_transitions.resize(m_transitions.size() + m_classCount, NONE);
+                }
+                state = m_transitions[state * m_classCount + m_byteClasses[static_cast<uint8_t>(c)]];
+            }
+            m_outputs[state] = static_cast<int32_t>(index);
+        }
+
+        //failure links in breadth first order turn the trie into a complete automaton
+        const std::size_t stateCount = m_outputs.size();
+        std::vector<uint32_t> failures(stateCount, 0);
+        m_outputLinks.assign(stateCount, 0);
+        std::vector<uint32_t> queue;
+        queue.reserve(stateCount);
+        for (uint32_t cls = 0; cls < m_classCount; cls++)
+        {
+            uint32_t& next = m_transitions[cls];
+            if (next == NONE)
+                next = 0;
+            else
+                queue.push_back(next);
+        }
+        for (std::size_t head = 0; head < queue.size(); head++)
+        {
+            uint32_t state = queue[head];
+            for (uint32_t cls = 0; cls < m_classCount; cls++)
+            {
+                uint32_t& next = m_transitions[state * m_classCount + cls];
+                uint32_t fallback = m_transitions[failures[state] * m_classCount + cls];
+                if (next == NONE)
+                {
+                    next = fallback;
+                    continue;
+                }
+
+                failures[next] = fallback;
+                m_outputLinks[next] = (m_outputs[fallback] >= 0) ? fallback : m_outputLinks[fallback];
+                queue.push_back(next);
+            }
+        }
+    }
+
+    std::optional<uint32_t> SpecialTokenScanner::IndexOf(std::string_view token) const
+    {
+        auto it = std::lower_bound(m_tokens.begin(), m_tokens.end(), token);
+        if ((it == m_tokens.end()) || (*it != token))
+            return std::nullopt;
+
+        return static_cast<uint32_t>(it - m_tokens.begin());
+    }
+
+    std::optional<SpecialTokenMatch> SpecialTokenScanner::FindFirst(std::string_view text, std::size_t pos, const std::vector<bool>& mask) const
+    {
+        if (m_tokens.empty() || (pos > text.size()) || (text.size() - pos < m_minLength))
+            return std::nullopt;
+
+        const uint8_t* s = reinterpret_cast<const uint8_t*>(text.data());
+        const std::size_t end = text.size();
+        std::optional<SpecialTokenMatch> best;
+        uint32_t state = 0;
+        for (std::size_t i = pos; i < end; i++)
+        {
+            if ((state == 0) && (m_firstByte >= 0))
+            {
+                const void* found = std::memchr(s + i, m_firstByte, end - i);
+                if (found == nullptr)
+                    break;
+                i = static_cast<const uint8_t*>(found) - s;
+            }
+
+            state = Next(state, s[i]);
+            for (uint32_t out = (m_outputs[state] >= 0) ? state : m_outputLinks[state]; out != 0; out = m_outputLinks[out])
+            {
+                uint32_t index = static_cast<uint32_t>(m_outputs[out]);
+                if (!mask[index])
+                    continue;
+
+                std::size_t start = i + 1 - m_tokens[index].size();
+                if (!best || (start < best->start) || ((start == best->start) && (i + 1 > best->end)))
+                    best = SpecialTokenMatch{ start, i + 1, index };
+            }
+
+            //matches ending later start after the best one
+            if (best && (i + 2 > best->start + m_maxLength))
+                break;
+        }
+
+        return best;
+    }
+
+    std::size_t SpecialTokenScanner::MemoryUsage() const
+    {
+        std::size_t usage = m_transitions.capacity() * sizeof(uint32_t) + m_outputs.capacity() * sizeof(int32_t)
+            + m_outputLinks.capacity() * sizeof(uint32_t) + m_ids.capacity() * sizeof(uint32_t);
+        for (const auto& token : m_tokens)
+            usage += sizeof(token) + token.capacity();
+
+        return usage;
+    }
+}
@@ -3,8 +3,6 @@
 
 namespace TiktokenCpp
 {
-    static SystemInit s_sysInit;
-
     void InitSystemEnv()
     {
         stdfs::path curpath = stdfs::current_path();
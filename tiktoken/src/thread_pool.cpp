@@ -0,0 +1,178 @@
+#include <exception>
+#include <algorithm>
+#include "thread_pool.h"
+
+namespace TiktokenCpp
+{
+    //queue of the worker running on this thread, none for other threads
+    static thread_local const ThreadPool* t_pool = nullptr;
+    static thread_local std::size_t t_queue = 0;
+
+    struct ThreadPool::Job
+    {
+        const std::function<void(std::size_t)>* body;
+        std::atomic<std::size_t> remaining;
+        std::mutex mutex;
+        std::condition_variable done;
+        std::exception_ptr error;
+    };
+
+    ThreadPool::ThreadPool(std::size_t workers)
+    {
+        for (std::size_t i = 0; i <= workers; i++)
+            m_queues.push_back(std::make_unique<Queue>());
+        m_workers.reserve(workers);
+        for (std::size_t i = 0; i < workers; i++)
+            m_workers.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& worker : m_workers)
+            worker.join();
+    }
+
+    ThreadPool& ThreadPool::Shared()
+    {
+        static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+        return pool;
+    }
+
+    void ThreadPool::ParallelFor(std::size_t count, const std::function<void(std::size_t)>& body)
+    {
+        if (count == 0)
+            return;
+
+        const std::size_t self = (t_pool == this) ? t_queue : m_queues.size() - 1;
+        if ((count == 1) || m_workers.empty())
+        {
+            for (std::size_t i = 0; i < count; i++)
+                body(i);
+            return;
+        }
+
+        Job job;
+        job.body = &body;
+        job.remaining = count;
+
+        //one contiguous share per queue, the calling thread's queue first
+        const std::size_t shares = std::min(count, m_queues.size());
+        for (std::size_t share = 0; share < shares; share++)
+        {
+            Queue& queue = *m_queues[(self + share) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.ranges.push_back(Range{ &job, count * share / shares, count * (share + 1) / shares });
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_queued += static_cast<std::int64_t>(count);
+        }
+        m_wake.notify_all();
+
+        while ((job.remaining.load() > 0) && RunOne(self))
+            ;
+
+        //the last indexes may still run on other threads
+        {
+            std::unique_lock<std::mutex> lock(job.mutex);
+            job.done.wait(lock, [&job]() { return job.remaining.load() == 0; });
+        }
+
+        if (job.error)
+            std::rethrow_exception(job.error);
+    }
+
+    bool ThreadPool::TakeOwn(std::size_t self, Range& task)
+    {
+        Queue& queue = *m_queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.ranges.empty())
+            return false;
+
+        Range& back = queue.ranges.back();
+        task = Range{ back.job, back.end - 1, back.end };
+        if (--back.end == back.begin)
+            queue.ranges.pop_back();
+        return true;
+    }
+
+    bool ThreadPool::Steal(std::size_t self, Range& task)
+    {
+        for (std::size_t i = 1; i < m_queues.size(); i++)
+        {
+            Queue& victim = *m_queues[(self + i) % m_queues.size()];
+            Range stolen;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (victim.ranges.empty())
+                    continue;
+
+                //the first half of the oldest range, the owner keeps working on its end
+                Range& front = victim.ranges.front();
+                std::size_t half = (front.end - front.begin + 1) / 2;
+                stolen = Range{ front.job, front.begin, front.begin + half };
+                front.begin += half;
+                if (front.begin == front.end)
+                    victim.ranges.pop_front();
+            }
+
+            task = Range{ stolen.job, stolen.begin, stolen.begin + 1 };
+            if (stolen.begin + 1 < stolen.end)
+            {
+                Queue& queue = *m_queues[self];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                queue.ranges.push_back(Range{ stolen.job, stolen.begin + 1, stolen.end });
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    bool ThreadPool::RunOne(std::size_t self)
+    {
+        Range task;
+        if (!TakeOwn(self, task) && !Steal(self, task))
+            return false;
+
+        m_queued--;
+        Job& job = *task.job;
+        try
+        {
+            (*job.body)(task.begin);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            if (!job.error)
+                job.error = std::current_exception();
+        }
+
+        //under the lock: the caller frees the job once it holds the lock and sees no call left
+        std::lock_guard<std::mutex> lock(job.mutex);
+        if (job.remaining.fetch_sub(1) == 1)
+            job.done.notify_all();
+        return true;
+    }
+
+    void ThreadPool::WorkerLoop(std::size_t self)
+    {
+        t_pool = this;
+        t_queue = self;
+        while (true)
+        {
+            if (RunOne(self))
+                continue;
+
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wake.wait(lock, [this]() { return m_stop || (m_queued.load() > 0); });
+            if (m_stop && (m_queued.load() <= 0))
+                return;
+        }
+    }
+}
@@ -1,10 +1,16 @@
 ﻿#include <fstream>
+#include <mutex>
+#include <future>
+#include <unordered_map>
 #include "registry.h"
 #include "model.h"
 #include "sys_env.h"
 #include "ScopeGuard.h"
 #include <boost/algorithm/string.hpp>
 #include <curl/curl.h>
+#include "utils.h"
+#include "vocab_file.h"
+#include "embedded_encoding.h"
 #include "tiktoken.h"
 
 namespace TiktokenCpp
@@ -24,10 +30,25 @@ namespace TiktokenCpp
 
     bool IsLocalEncodingCacheExisted(const std::string_view& encoding_name)
     {
+        if (FindEmbeddedEncoding(encoding_name) != nullptr)
+            return true;
+
         std::string filename = std::string(encoding_name) + ".tiktoken";
         stdfs::path path = GetCacheFileFullPath(filename);
 
-        return stdfs::exists(path);
+        return stdfs::exists(path) || stdfs::exists(GetCacheFileFullPath(std::string(encoding_name) + VOCAB_FILE_EXTENSION));
+    }
+
+    bool ConvertEncodingToBinary(const std::string_view& encoding_name)
+    {
+        try
+        {
+            return ConvertTiktokenToBinary(encoding_name);
+        }
+        catch (const std::runtime_error&)
+        {
+            return false;
+        }
     }
 
     std::string GetCachedEncodingFileLocation()
@@ -35,14 +56,147 @@ namespace TiktokenCpp
         return GetCachePathName();
     }
 
-    std::unique_ptr<TikToken> GetEncoding(const std::string_view& encoding_name)
+    //process-wide encoding cache, keyed by encoding name
+    class EncodingCache final
     {
-        const EncodingParam& param = Registry::GetEncodingParam(encoding_name);
+    public:
+        static EncodingCache& Instance()
+        {
+            static EncodingCache s_cache;
+            return s_cache;
+        }
+
+        std::shared_ptr<const TikToken> Get(const std::string_view& encoding_name)
+        {
+            const EncodingParam& param = Registry::GetEncodingParam(encoding_name);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            auto it = m_entries.find(param.name);
+            if (it != m_entries.end())
+            {
+                it->second.lastUse = ++m_useClock;
+                std::shared_future<TikTokenPtr> loading = it->second.encoding;
+                lock.unlock();
 
-        return std::make_unique<TikToken>(param);
+                return loading.get(); //wait here if another thread is still loading it
+            }
+
+            std::promise<TikTokenPtr> promise;
+            m_entries.emplace(param.name, CacheEntry{ promise.get_future().share(), ++m_useClock, 0 });
+            lock.unlock();
+
+            TikTokenPtr encoding;
+            try
+            {
+                encoding = std::make_shared<const TikToken>(param);
+            }
+            catch (...)
+            {
+                lock.lock();
+                m_entries.erase(param.name); //let later calls retry
+                lock.unlock();
+                promise.set_exception(std::current_exception());
+                throw;
+            }
+            promise.set_value(encoding);
+
+            lock.lock();
+            auto loaded = m_entries.find(param.name);
+            if (loaded != m_entries.end())
+                loaded->second.memory = encoding->MemoryUsage();
+            EnforceBudget();
+
+            return encoding;
+        }
+
+        void SetBudget(std::size_t bytes)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_budget = bytes;
+            EnforceBudget();
+        }
+
+        std::size_t ReleaseIdle()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            std::size_t released = 0;
+            for (auto it = m_entries.begin(); it != m_entries.end();)
+            {
+                if (IsIdle(it->second))
+                {
+                    it = m_entries.erase(it);
+                    released++;
+                }
+                else
+                    ++it;
+            }
+
+            return released;
+        }
+
+    private:
+        using TikTokenPtr = std::shared_ptr<const TikToken>;
+
+        struct CacheEntry
+        {
+            std::shared_future<TikTokenPtr> encoding;
+            uint64_t lastUse;
+            std::size_t memory; //0 while loading
+        };
+
+        EncodingCache() = default;
+
+        //loaded and only referenced by the cache itself
+        static bool IsIdle(const CacheEntry& entry)
+        {
+            return (entry.memory != 0) && (entry.encoding.get().use_count() == 1);
+        }
+
+        //caller holds m_mutex
+        void EnforceBudget()
+        {
+            std::size_t total = 0;
+            for (const auto& entry : m_entries)
+                total += entry.second.memory;
+
+            while (total > m_budget)
+            {
+                auto victim = m_entries.end();
+                for (auto it = m_entries.begin(); it != m_entries.end(); ++it)
+                {
+                    if (IsIdle(it->second) && ((victim == m_entries.end()) || (it->second.lastUse < victim->second.lastUse)))
+                        victim = it;
+                }
+                if (victim == m_entries.end())
+                    break; //everything left is in use
+
+                total -= victim->second.memory;
+                m_entries.erase(victim);
+            }
+        }
+
+        std::mutex m_mutex;
+        std::unordered_map<std::string_view, CacheEntry> m_entries; //keys point to the static registry names
+        std::size_t m_budget = std::numeric_limits<std::size_t>::max();
+        uint64_t m_useClock = 0;
+    };
+
+    std::shared_ptr<const TikToken> GetEncoding(const std::string_view& encoding_name)
+    {
+        return EncodingCache::Instance().Get(encoding_name);
+    }
+
+    void SetEncodingCacheBudget(std::size_t bytes)
+    {
+        EncodingCache::Instance().SetBudget(bytes);
+    }
+
+    std::size_t ReleaseIdleEncodings()
+    {
+        return EncodingCache::Instance().ReleaseIdle();
     }
 
-    std::unique_ptr<TikToken> EncodingForModel(const std::string& model_name)
+    std::shared_ptr<const TikToken> EncodingForModel(const std::string& model_name)
     {
         std::string lowerName = boost::to_lower_copy(model_name);
         std::string_view encoding_name = Model::EncodingNameForModel(lowerName.c_str());
@@ -99,6 +253,7 @@ namespace TiktokenCpp
         const EncodingParam& param = Registry::GetEncodingParam(name);
         std::string filename = std::string(name) + ".tiktoken";
         stdfs::path path = GetCacheFileFullPath(filename);
+        InitSystemEnv();
 
         return DownloadFile(param.bpe_url, proxy.value_or(""), path);
     }
@@ -1,15 +1,10 @@
-#ifndef NO_CPP20_FORMAT
-    #include <format>
-#else
-    #include <boost/format.hpp>
-#endif
-#include <boost/algorithm/string/join.hpp>
-#include <boost/algorithm/string/replace.hpp>
+#include <algorithm>
+#include <iterator>
 #include "Utf8String.h"
 #include "error_handler.h"
-#include "pcre2cpp.h"
 #include "core_bpe.h"
 #include "utils.h"
+#include "thread_pool.h"
 #include "token_encoding.h"
 
 
@@ -29,36 +24,88 @@ namespace TiktokenCpp
     }
 
     //get max token value from encoding map
-    std::uint32_t GetMaxTokenValue(const encode_dict* pDict)
+    std::uint32_t GetMaxTokenValue(const BpeVocab* pDict)
     {
         assert(pDict != nullptr);
-        std::uint32_t value = static_cast<std::uint32_t>(pDict->size());
+        std::uint32_t value = static_cast<std::uint32_t>(pDict->Size());
         if (value != 0)
             value -= 1;
         return value;
     }
 
-    Pcre2::CPcre2Regex<char> SpecialTokenRegex(const StringSet& tokens)
+    //"all" selects every special token, any other single string only that token. names are
+    //taken in the local multibyte encoding and returned as UTF-8, as all is
+    static StringSet SpecialSetOf(const StringSetUnion& special, const StringSet& all)
     {
-        std::vector<std::string> strVec(tokens.size());
-        /*
-        std::transform(tokens.begin(), tokens.end(), strVec.begin(),
-            [](const std::string& str) { return boost::replace_all_copy(str, "\\", "\\\\"); });
-        */
-        std::transform(tokens.begin(), tokens.end(), strVec.begin(),
-            [](const std::string& str) { return EscapeRegex(str); });
-#ifndef NO_CPP20_FORMAT
-        return Pcre2::CPcre2Regex<char>(std::format("({})", boost::join(strVec, "|")));
-#else
-        boost::format regexFmt("(%1%)");
-        regexFmt % boost::join(strVec, "|");
-        return Pcre2::CPcre2Regex<char>(regexFmt.str());
-#endif
+        if (special.index() == 0)
+        {
+            std::string_view name = std::get<0>(special);
+            if (name == "all")
+                return all;
+
+            return name.empty() ? StringSet{} : StringSet{ UTF8StrFromLocalMBCS(std::string(name)) };
+        }
+
+        return Utf8StrsetFromStrSet(std::get<1>(special));
+    }
+
+    EncodeOptions::EncodeOptions(const TikToken& encoding, StringSetUnion allowedSpecial, StringSetUnion disallowedSpecial)
+        : m_encoding(&encoding)
+    {
+        const StringSet& all = encoding.m_SpecialTokensSet;
+        StringSet allowedSpecialSet = SpecialSetOf(allowedSpecial, all);
+        StringSet disallowedSpecialSet;
+        if ((disallowedSpecial.index() == 0) && (std::get<0>(disallowedSpecial) == "all"))
+        {
+            std::set_difference(all.begin(), all.end(), allowedSpecialSet.begin(), allowedSpecialSet.end(),
+                std::inserter(disallowedSpecialSet, disallowedSpecialSet.begin()));
+        }
+        else
+            disallowedSpecialSet = SpecialSetOf(disallowedSpecial, all);
+
+        const SpecialTokenScanner& scanner = encoding.m_corebpe->GetSpecialScanner();
+        m_allowed.resize(scanner.Count());
+        m_disallowed.resize(scanner.Count());
+        for (const auto& token : allowedSpecialSet)
+        {
+            std::optional<uint32_t> index = scanner.IndexOf(token);
+            if (index.has_value())
+            {
+                m_allowed[*index] = true;
+                m_anyAllowed = true;
+            }
+        }
+        for (const auto& token : disallowedSpecialSet)
+        {
+            std::optional<uint32_t> index = scanner.IndexOf(token);
+            if (index.has_value())
+            {
+                m_disallowed[*index] = true;
+                m_anyDisallowed = true;
+            }
+            else if (!token.empty())
+                m_unknownDisallowed.push_back(token);
+        }
+    }
+
+    bool EncodeOptions::IsAllowed(std::string_view token) const
+    {
+        std::optional<uint32_t> index = m_encoding->m_corebpe->GetSpecialScanner().IndexOf(token);
+        return index.has_value() && m_allowed[*index];
+    }
+
+    bool EncodeOptions::IsDisallowed(std::string_view token) const
+    {
+        std::optional<uint32_t> index = m_encoding->m_corebpe->GetSpecialScanner().IndexOf(token);
+        if (index.has_value())
+            return m_disallowed[*index];
+
+        return std::find(m_unknownDisallowed.begin(), m_unknownDisallowed.end(), token) != m_unknownDisallowed.end();
     }
 
     TikToken::TikToken(const EncodingParam& param)
     {
-        std::unique_ptr<encode_dict> encoder = GetTiktokenEncoding(param.name);
+        std::unique_ptr<BpeVocab> encoder = GetTiktokenEncoding(param.name);
         if(encoder == nullptr)
             ThrowGeneralException("local cache not find encoding file, please download encoding file first. encoding name: ", param.name);
 
@@ -66,12 +113,12 @@ namespace TiktokenCpp
         m_maxTokenValue = std::max(GetMaxTokenValue(encoder.get()), GetMaxSpecialTokenValue(param.special_tokens));
         if (param.vocab_n.has_value())
         {
-            assert((param.special_tokens.size() + encoder->size()) == param.vocab_n.value());
+            assert((param.special_tokens.size() + encoder->Size()) == param.vocab_n.value());
             assert(m_maxTokenValue == (param.vocab_n.value() - 1));
         }
 
         for_each(param.special_tokens.begin(), param.special_tokens.end(),
-            [this](const auto& spi) {m_SpecialTokensSet.insert(spi.first.data()); });
+            [this](const auto& spi) {m_SpecialTokensSet.insert(UTF8StrFromLocalMBCS(std::string(spi.first))); });
 
         m_corebpe = std::make_unique<CoreBpe>(std::move(encoder), param.special_tokens, param.pat_str);
     }
@@ -80,80 +127,344 @@ namespace TiktokenCpp
     {
     }
 
-    std::vector<uint32_t> TikToken::EncodeOrdinary(const std::string& utf8Text)
+    std::vector<uint32_t> TikToken::EncodeOrdinary(const std::string& utf8Text) const
     {
-        try 
-        {
-            return m_corebpe->EncodeOrdinaryNative(utf8Text);
-        }
-        catch (const UnicodeEncoderException& e)
+        //invalid UTF-8 is encoded byte level, Decode() gives back the same bytes
+        return m_corebpe->EncodeOrdinaryNative(utf8Text);
+    }
+
+    std::vector<uint32_t> TikToken::Encode(const std::string& utf8Text,
+                                          StringSetUnion allowedSpecial, StringSetUnion disallowedSpecial) const
+    {
+        return Encode(utf8Text, EncodeOptions(*this, std::move(allowedSpecial), std::move(disallowedSpecial)));
+    }
+
+    std::vector<uint32_t> TikToken::Encode(const std::string& utf8Text, const EncodeOptions& options) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        std::vector<uint32_t> tokens;
+        AppendTokens(utf8Text, &options, tokens);
+
+        return tokens;
+    }
+
+    void TikToken::AppendTokens(std::string_view utf8Text, const EncodeOptions* options, std::vector<uint32_t>& tokens) const
+    {
+        if (options == nullptr)
         {
-            //text = text.encode("utf-16", "surrogatepass").decode("utf-16", "replace")
-            std::wstring utf16Text = UTF16LEStrFromUTF8(utf8Text);
-            return m_corebpe->EncodeOrdinaryNative(utf16Text);
+            m_corebpe->EncodeOrdinaryInto(utf8Text, tokens);
+            return;
         }
+
+        CheckDisallowed(utf8Text, *options);
+        static const std::vector<bool> NONE_ALLOWED;
+        m_corebpe->EncodeNativeInto(utf8Text, options->m_anyAllowed ? options->m_allowed : NONE_ALLOWED, tokens);
     }
 
-    std::vector<uint32_t> TikToken::Encode(const std::string& utf8Text,
-                                          StringSetUnion allowedSpecial, StringSetUnion disallowedSpecial)
+    void TikToken::EncodeOrdinaryInto(std::string_view utf8Text, std::vector<uint32_t>& tokens) const
     {
-        StringSet allowedSpecialSet, disallowedSpecialSet; //null set
-        if ((allowedSpecial.index() == 0) && (std::get<0>(allowedSpecial) == "all"))
-            allowedSpecialSet = m_SpecialTokensSet;
-        else
-            allowedSpecialSet = std::move(std::get<1>(allowedSpecial));
-        
-        if ((disallowedSpecial.index() == 0) && (std::get<0>(disallowedSpecial) == "all"))
+        AppendTokens(utf8Text, nullptr, tokens);
+    }
+
+    void TikToken::EncodeInto(std::string_view utf8Text, const EncodeOptions& options, std::vector<uint32_t>& tokens) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        AppendTokens(utf8Text, &options, tokens);
+    }
+
+    std::size_t TikToken::EncodeOrdinaryInto(std::string_view utf8Text, std::span<uint32_t> buffer) const
+    {
+        static const std::vector<bool> NONE_ALLOWED;
+        return m_corebpe->EncodeNativeToSpan(utf8Text, NONE_ALLOWED, buffer);
+    }
+
+    std::size_t TikToken::EncodeInto(std::string_view utf8Text, const EncodeOptions& options, std::span<uint32_t> buffer) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        CheckDisallowed(utf8Text, options);
+        static const std::vector<bool> NONE_ALLOWED;
+        return m_corebpe->EncodeNativeToSpan(utf8Text, options.m_anyAllowed ? options.m_allowed : NONE_ALLOWED, buffer);
+    }
+
+    void TikToken::EncodeOrdinaryInto(std::string_view utf8Text, const TokenSink& sink, std::size_t chunkTokens) const
+    {
+        static const std::vector<bool> NONE_ALLOWED;
+        m_corebpe->EncodeNativeChunked(utf8Text, NONE_ALLOWED, chunkTokens, sink);
+    }
+
+    void TikToken::EncodeInto(std::string_view utf8Text, const EncodeOptions& options, const TokenSink& sink, std::size_t chunkTokens) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        CheckDisallowed(utf8Text, options);
+        static const std::vector<bool> NONE_ALLOWED;
+        m_corebpe->EncodeNativeChunked(utf8Text, options.m_anyAllowed ? options.m_allowed : NONE_ALLOWED, chunkTokens, sink);
+    }
+
+    void TikToken::CheckDisallowed(std::string_view utf8Text, const EncodeOptions& options) const
+    {
+        bool disallowedFound = options.m_anyDisallowed && m_corebpe->GetSpecialScanner().FindFirst(utf8Text, 0, options.m_disallowed).has_value();
+        for (const auto& token : options.m_unknownDisallowed)
+            disallowedFound = disallowedFound || (utf8Text.find(token) != std::string::npos);
+        if (disallowedFound)
+            ThrowDisallowedSpecial();
+    }
+
+    std::size_t TikToken::CountTokensOrdinary(std::string_view utf8Text) const
+    {
+        return m_corebpe->CountOrdinaryNative(utf8Text);
+    }
+
+    std::size_t TikToken::CountTokens(std::string_view utf8Text, StringSetUnion allowedSpecial, StringSetUnion disallowedSpecial) const
+    {
+        return CountTokens(utf8Text, EncodeOptions(*this, std::move(allowedSpecial), std::move(disallowedSpecial)));
+    }
+
+    std::size_t TikToken::CountTokens(std::string_view utf8Text, const EncodeOptions& options) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        CheckDisallowed(utf8Text, options);
+        static const std::vector<bool> NONE_ALLOWED;
+        return m_corebpe->CountNative(utf8Text, options.m_anyAllowed ? options.m_allowed : NONE_ALLOWED);
+    }
+
+    TokenOffsets TikToken::EncodeOrdinaryWithOffsets(std::string_view utf8Text, bool withUtf16) const
+    {
+        return m_corebpe->EncodeOrdinaryWithOffsets(utf8Text, withUtf16);
+    }
+
+    TokenOffsets TikToken::EncodeWithOffsets(std::string_view utf8Text, const EncodeOptions& options, bool withUtf16) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        CheckDisallowed(utf8Text, options);
+        static const std::vector<bool> NONE_ALLOWED;
+        return m_corebpe->EncodeWithOffsets(utf8Text, options.m_anyAllowed ? options.m_allowed : NONE_ALLOWED, withUtf16);
+    }
+
+    TokenPrefix TikToken::EncodeUpTo(std::string_view utf8Text, std::size_t maxTokens) const
+    {
+        return m_corebpe->EncodeUpTo(utf8Text, maxTokens);
+    }
+
+    std::string_view TikToken::PrefixUpTo(std::string_view utf8Text, std::size_t maxTokens) const
+    {
+        std::string_view prefix = utf8Text.substr(0, m_corebpe->EncodeUpTo(utf8Text, maxTokens).bytes);
+
+        return prefix.substr(0, ValidUtf8Length(prefix));
+    }
+
+    std::vector<uint32_t> TikToken::EncodeOrdinary(const std::wstring& wideText) const
+    {
+        return m_corebpe->EncodeOrdinaryNative(wideText);
+    }
+
+    std::vector<uint32_t> TikToken::Encode(const std::wstring& wideText,
+                                          StringSetUnion allowedSpecial, StringSetUnion disallowedSpecial) const
+    {
+        return Encode(wideText, EncodeOptions(*this, std::move(allowedSpecial), std::move(disallowedSpecial)));
+    }
+
+    std::vector<uint32_t> TikToken::Encode(const std::wstring& wideText, const EncodeOptions& options) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        for (const auto& token : options.m_unknownDisallowed)
         {
-            StringSet tmp;
-            std::set_difference(m_SpecialTokensSet.begin(), m_SpecialTokensSet.end(), 
-                                allowedSpecialSet.begin(), allowedSpecialSet.end(),
-                                std::inserter(tmp, tmp.begin()));
-            disallowedSpecialSet = std::move(tmp);
+            if (wideText.find(WideFromUTF8(token)) != std::wstring::npos)
+                ThrowDisallowedSpecial();
         }
-        else
-            disallowedSpecialSet = std::move(std::get<1>(disallowedSpecial));
 
-        if (disallowedSpecialSet.size() > 0)
+        //special tokens of the encoding are checked while the text is transcoded
+        static const std::vector<bool> NONE;
+        return m_corebpe->EncodeNative(wideText, options.m_anyAllowed ? options.m_allowed : NONE,
+                                       options.m_anyDisallowed ? options.m_disallowed : NONE);
+    }
+
+    //contiguous groups of texts of about the same byte size, several per thread of the pool so
+    //that stealing evens out uneven texts. group g is texts [bounds[g], bounds[g + 1])
+    static std::vector<std::size_t> SplitBatch(std::span<const std::string_view> texts, std::size_t concurrency)
+    {
+        //small batches are not worth waking the pool for
+        const std::size_t MIN_GROUP_BYTES = 16 * 1024;
+        const std::size_t GROUPS_PER_THREAD = 8;
+
+        std::size_t total = 0;
+        for (const auto& text : texts)
+            total += text.size() + 1;
+        const std::size_t target = std::max(MIN_GROUP_BYTES, total / (concurrency * GROUPS_PER_THREAD) + 1);
+
+        std::vector<std::size_t> bounds{ 0 };
+        std::size_t groupBytes = 0;
+        for (std::size_t i = 0; i < texts.size(); i++)
         {
-            Pcre2::CPcre2Regex<char> regex = SpecialTokenRegex(disallowedSpecialSet);
-            if (regex.Match(utf8Text))
+            groupBytes += texts[i].size() + 1;
+            if ((groupBytes >= target) || (i + 1 == texts.size()))
             {
-                const  char* ValueError = "Encountered text corresponding to disallowed special token {token!r}.\n"
-                    "If you want this text to be encoded as a special token, "
-                    "pass it to `allowed_special`, e.g. `allowed_special={{{token!r}, ...}}`.\n"
-                    "If you want this text to be encoded as normal text, disable the check for this token "
-                    "by passing `disallowed_special=(enc.special_tokens_set - {{{token!r}}})`.\n"
-                    "To disable this check for all special tokens, pass `disallowed_special=()`.\n";
-
-                throw std::runtime_error(ValueError);
+                bounds.push_back(i + 1);
+                groupBytes = 0;
             }
         }
 
-        try
-        {
-            return m_corebpe->EncodeNative(utf8Text, Utf8StrsetFromStrSet(allowedSpecialSet));
-        }
-        catch (const UnicodeEncoderException& e)
+        return bounds;
+    }
+
+    std::vector<std::vector<uint32_t>> TikToken::EncodeBatch(std::span<const std::string_view> texts) const
+    {
+        return EncodeBatch(texts, nullptr);
+    }
+
+    std::vector<std::vector<uint32_t>> TikToken::EncodeBatch(std::span<const std::string_view> texts, const EncodeOptions& options) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        return EncodeBatch(texts, &options);
+    }
+
+    std::vector<std::vector<uint32_t>> TikToken::EncodeBatch(std::span<const std::string_view> texts, const EncodeOptions* options) const
+    {
+        std::vector<std::vector<uint32_t>> result(texts.size());
+        ThreadPool& pool = ThreadPool::Shared();
+        std::vector<std::size_t> bounds = SplitBatch(texts, pool.Concurrency());
+        pool.ParallelFor(bounds.size() - 1, [&](std::size_t group)
+            {
+                for (std::size_t i = bounds[group]; i < bounds[group + 1]; i++)
+                    AppendTokens(texts[i], options, result[i]);
+            });
+
+        return result;
+    }
+
+    TokenBatch TikToken::EncodeBatchFlat(std::span<const std::string_view> texts) const
+    {
+        return EncodeBatchFlat(texts, nullptr);
+    }
+
+    TokenBatch TikToken::EncodeBatchFlat(std::span<const std::string_view> texts, const EncodeOptions& options) const
+    {
+        if (options.m_encoding != this)
+            throw std::invalid_argument("encode options are made for another encoding");
+
+        return EncodeBatchFlat(texts, &options);
+    }
+
+    TokenBatch TikToken::EncodeBatchFlat(std::span<const std::string_view> texts, const EncodeOptions* options) const
+    {
+        //every group encodes into its own buffer, the buffers are joined in order afterwards
+        ThreadPool& pool = ThreadPool::Shared();
+        std::vector<std::size_t> bounds = SplitBatch(texts, pool.Concurrency());
+        std::vector<std::vector<uint32_t>> groupTokens(bounds.size() - 1);
+        TokenBatch batch;
+        batch.offsets.resize(texts.size() + 1, 0);
+        pool.ParallelFor(groupTokens.size(), [&](std::size_t group)
+            {
+                for (std::size_t i = bounds[group]; i < bounds[group + 1]; i++)
+                {
+                    AppendTokens(texts[i], options, groupTokens[group]);
+                    batch.offsets[i + 1] = groupTokens[group].size(); //relative to the group for now
+                }
+            });
+
+        std::size_t total = 0;
+        for (std::size_t group = 0; group < groupTokens.size(); group++)
         {
-            //text = text.encode("utf-16", "surrogatepass").decode("utf-16", "replace")
-            std::wstring utf16Text = UTF16LEStrFromUTF8(utf8Text);
-            return m_corebpe->EncodeNative(utf16Text, Utf8StrsetFromStrSet(allowedSpecialSet));
+            for (std::size_t i = bounds[group]; i < bounds[group + 1]; i++)
+                batch.offsets[i + 1] += total;
+            total += groupTokens[group].size();
         }
+        batch.tokens.resize(total);
+        pool.ParallelFor(groupTokens.size(), [&](std::size_t group)
+            {
+                std::copy(groupTokens[group].begin(), groupTokens[group].end(), batch.tokens.begin() + batch.offsets[bounds[group]]);
+            });
+
+        return batch;
     }
 
-    std::string TikToken::Decode(const std::vector<uint32_t>& tokens)
+    std::vector<uint32_t> TikToken::EncodeOrdinaryParallel(std::string_view utf8Text, std::size_t chunkBytes) const
     {
-        std::string result;
-        result.reserve(tokens.size() * 8);
+        return m_corebpe->EncodeOrdinaryParallel(utf8Text, chunkBytes);
+    }
 
-        auto strVec = m_corebpe->DecodeNative(tokens);
-        for (const auto& str : strVec)
-            result += str;
+    std::vector<std::string> TikToken::DecodeBatch(std::span<const std::vector<uint32_t>> batch) const
+    {
+        std::vector<std::string> texts(batch.size());
+        ThreadPool& pool = ThreadPool::Shared();
+        const std::size_t groups = std::min(batch.size(), pool.Concurrency() * 8);
+        pool.ParallelFor(groups, [&](std::size_t group)
+            {
+                for (std::size_t i = batch.size() * group / groups; i < batch.size() * (group + 1) / groups; i++)
+                    m_corebpe->DecodeBytes(batch[i], texts[i]);
+            });
+
+        return texts;
+    }
+
+    std::vector<std::string> TikToken::DecodeBatch(const TokenBatch& batch) const
+    {
+        const std::size_t count = batch.offsets.empty() ? 0 : batch.offsets.size() - 1;
+        std::vector<std::string> texts(count);
+        ThreadPool& pool = ThreadPool::Shared();
+        const std::size_t groups = std::min(count, pool.Concurrency() * 8);
+        std::span<const uint32_t> tokens(batch.tokens);
+        pool.ParallelFor(groups, [&](std::size_t group)
+            {
+                for (std::size_t i = count * group / groups; i < count * (group + 1) / groups; i++)
+                    m_corebpe->DecodeBytes(tokens.subspan(batch.offsets[i], batch.offsets[i + 1] - batch.offsets[i]), texts[i]);
+            });
+
+        return texts;
+    }
+
+    std::string TikToken::Decode(const std::vector<uint32_t>& tokens) const
+    {
+        std::string result;
+        m_corebpe->DecodeBytes(tokens, result);
 
         return result;
     }
 
+    std::size_t TikToken::DecodedLength(std::span<const uint32_t> tokens) const
+    {
+        return m_corebpe->DecodedLength(tokens);
+    }
+
+    std::size_t TikToken::DecodeInto(std::span<const uint32_t> tokens, std::span<char> buffer) const
+    {
+        return m_corebpe->DecodeInto(tokens, buffer);
+    }
+
+    std::size_t TikToken::MemoryUsage() const
+    {
+        std::size_t usage = sizeof(TikToken) + m_corebpe->MemoryUsage();
+        for (const auto& token : m_SpecialTokensSet)
+            usage += sizeof(std::string) + token.capacity();
+
+        return usage;
+    }
+
+    PieceCacheStats TikToken::GetPieceCacheStats() const
+    {
+        return m_corebpe->GetPieceCacheStats();
+    }
+
+    void TikToken::SetPieceCacheLimit(std::size_t bytes) const
+    {
+        m_corebpe->SetPieceCacheLimit(bytes);
+    }
+
     std::string TikToken::TokenToSymbol(uint32_t token) const
     { 
         return m_corebpe->TokenToSymbol(token);
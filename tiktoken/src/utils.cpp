@@ -1,46 +1,220 @@
-﻿#include <fstream>
-#include <regex>
+﻿#include <regex>
 #include <stdexcept>
 #include <cstring>
-#include <cppcodec/base64_rfc4648.hpp>
+#include <cassert>
+#include <array>
+#include <charconv>
+#include "MappedFile.h"
 #include "Utf8String.h"
 #include "sys_env.h"
 #include "registry.h"
 #include "utils.h"
+#include "vocab_file.h"
+#include "embedded_encoding.h"
+#include "thread_pool.h"
 
 
 namespace TiktokenCpp
 {
-    using base64 = cppcodec::base64_rfc4648;
+    //base64 char -> 6 bits value, 0xFF for chars out of the alphabet (including '=')
+    static constexpr std::array<uint8_t, 256> MakeBase64Table()
+    {
+        std::array<uint8_t, 256> table{};
+        table.fill(0xFF);
+        const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+        for (uint8_t i = 0; i < 64; i++)
+            table[static_cast<uint8_t>(alphabet[i])] = i;
+
+        return table;
+    }
+
+    static constexpr std::array<uint8_t, 256> BASE64_TABLE = MakeBase64Table();
+
+    //decoded size of a padded base64 text, 0 if the length is invalid
+    static std::size_t Base64DecodedSize(const char* text, std::size_t length)
+    {
+        if ((length == 0) || ((length % 4) != 0))
+            return 0;
+
+        std::size_t size = length / 4 * 3;
+        if (text[length - 1] == '=')
+            size--;
+        if (text[length - 2] == '=')
+            size--;
+
+        return size;
+    }
+
+    //decode a padded base64 text of Base64DecodedSize() bytes. every quad is decoded
+    //with four table loads and no per char branch, invalid chars are or-ed into one
+    //flag and checked once at the end
+    static bool Base64Decode(const char* text, std::size_t length, uint8_t* out)
+    {
+        const uint8_t* in = reinterpret_cast<const uint8_t*>(text);
+        uint32_t invalid = 0;
+        std::size_t last = length - 4;
+        for (std::size_t i = 0; i < last; i += 4, out += 3)
+        {
+            uint32_t a = BASE64_TABLE[in[i]], b = BASE64_TABLE[in[i + 1]], c = BASE64_TABLE[in[i + 2]], d = BASE64_TABLE[in[i + 3]];
+            invalid |= a | b | c | d;
+            uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+            out[0] = static_cast<uint8_t>(v >> 16);
+            out[1] = static_cast<uint8_t>(v >> 8);
+            out[2] = static_cast<uint8_t>(v);
+        }
+
+        //last quad may end with one or two '='
+        uint32_t a = BASE64_TABLE[in[last]], b = BASE64_TABLE[in[last + 1]];
+        uint32_t c = (in[last + 2] == '=') ? 0 : BASE64_TABLE[in[last + 2]];
+        uint32_t d = (in[last + 3] == '=') ? 0 : BASE64_TABLE[in[last + 3]];
+        invalid |= a | b | c | d;
+        if ((invalid & 0x80) || ((in[last + 2] == '=') && (in[last + 3] != '=')))
+            return false;
+
+        uint32_t v = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = static_cast<uint8_t>(v >> 16);
+        if (in[last + 2] != '=')
+            out[1] = static_cast<uint8_t>(v >> 8);
+        if (in[last + 3] != '=')
+            out[2] = static_cast<uint8_t>(v);
+
+        return true;
+    }
+
+    //one "<base64 token> <rank>" line of a .tiktoken file
+    struct TiktokenLine
+    {
+        const char* text; //base64 text in the mapped file
+        uint32_t length;
+        uint32_t rank;
+    };
+
+    static void ThrowInvalidTiktokenFile()
+    {
+        throw std::runtime_error("invaid token encoding file format!");
+    }
+
+    //parse lines of [begin, end), validate them and remember where the base64 texts are
+    static void ParseTiktokenLines(const char* begin, const char* end, std::vector<TiktokenLine>& lines)
+    {
+        lines.reserve((end - begin) / 12 + 1); //about 12 bytes per line for real vocabularies
+        while (begin < end)
+        {
+            const char* eol = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+            if (eol == nullptr)
+                eol = end;
+
+            const char* last = eol;
+            if ((last > begin) && (last[-1] == '\r'))
+                last--;
+            if (last > begin) //skip empty lines
+            {
+                const char* space = static_cast<const char*>(std::memchr(begin, ' ', last - begin));
+                if (space == nullptr)
+                    ThrowInvalidTiktokenFile();
 
-    std::unique_ptr<encode_dict> LoadTiktokenBpe(const std::string& pathname)
+                uint32_t rank = 0;
+                auto [ptr, ec] = std::from_chars(space + 1, last, rank);
+                if ((ec != std::errc()) || (ptr != last) || (Base64DecodedSize(begin, space - begin) == 0))
+                    ThrowInvalidTiktokenFile();
+
+                lines.push_back({ begin, static_cast<uint32_t>(space - begin), rank });
+            }
+            begin = eol + 1;
+        }
+    }
+
+    constexpr std::size_t LOADER_MIN_CHUNK_SIZE = 256 * 1024;
+
+    std::unique_ptr<BpeVocab> LoadTiktokenBpe(const std::string& pathname)
     {
-        std::unique_ptr<encode_dict> dict = std::make_unique<encode_dict>();
-        std::ifstream file(pathname, std::ios::in);
-        std::string tmpline;
-        while (!file.eof())
+        MappedFile file;
+        if (!file.Open(pathname))
+            throw std::runtime_error("can not open token encoding file: " + pathname);
+
+        //split the file into chunks at line boundaries, one chunk per thread of the shared pool.
+        //a load from inside a pool job runs its chunks on that job's thread, without new threads
+        ThreadPool& pool = ThreadPool::Shared();
+        const char* text = reinterpret_cast<const char*>(file.Data());
+        const char* textEnd = text + file.Size();
+        std::size_t chunks = std::min<std::size_t>(pool.Concurrency(), file.Size() / LOADER_MIN_CHUNK_SIZE + 1);
+        std::vector<const char*> bounds(chunks + 1, textEnd);
+        bounds[0] = text;
+        for (std::size_t i = 1; i < chunks; i++)
+        {
+            const char* pos = std::max(bounds[i - 1], text + file.Size() / chunks * i);
+            const char* eol = static_cast<const char*>(std::memchr(pos, '\n', textEnd - pos));
+            bounds[i] = (eol == nullptr) ? textEnd : eol + 1;
+        }
+
+        std::vector<std::vector<TiktokenLine>> chunkLines(chunks);
+        pool.ParallelFor(chunks, [&](std::size_t i) { ParseTiktokenLines(bounds[i], bounds[i + 1], chunkLines[i]); });
+
+        //rank table: decoded sizes by rank, then prefix sums give every token its place in the arena
+        uint32_t maxRank = 0;
+        std::size_t lineCount = 0;
+        for (const auto& lines : chunkLines)
+        {
+            for (const TiktokenLine& line : lines)
+                maxRank = std::max(maxRank, line.rank);
+            lineCount += lines.size();
+        }
+        if (lineCount == 0)
+            ThrowInvalidTiktokenFile();
+
+        std::vector<uint32_t> offsets(static_cast<std::size_t>(maxRank) + 2, 0);
+        for (const auto& lines : chunkLines)
         {
-            std::getline(file, tmpline);
-            if (tmpline.empty())
-                break;
-
-            auto space_pos = tmpline.find(' ', 4); //base64 编码最少 4 个字符
-            if (space_pos == std::string::npos)
-                throw std::runtime_error("invaid token encoding file format!");
-            
-            std::vector<uint8_t> token = base64::decode(tmpline.substr(0, space_pos));
-            int32_t rank = std::stoi(tmpline.substr(space_pos + 1));
-            dict->emplace(std::move(token), rank);
+            for (const TiktokenLine& line : lines)
+            {
+                if (offsets[line.rank + 1] != 0)
+                    throw std::runtime_error("duplicated rank in vocabulary");
+                offsets[line.rank + 1] = static_cast<uint32_t>(Base64DecodedSize(line.text, line.length));
+            }
         }
+        for (std::size_t i = 1; i < offsets.size(); i++)
+            offsets[i] += offsets[i - 1];
+
+        //every thread decodes its lines straight into their final place
+        std::vector<uint8_t> arena(offsets.back());
+        pool.ParallelFor(chunks, [&](std::size_t i)
+        {
+            for (const TiktokenLine& line : chunkLines[i])
+            {
+                if (!Base64Decode(line.text, line.length, arena.data() + offsets[line.rank]))
+                    ThrowInvalidTiktokenFile();
+            }
+        });
+
+        std::unique_ptr<BpeVocab> dict = std::make_unique<BpeVocab>();
+        dict->Assign(std::move(arena), std::move(offsets));
 
         return dict;
     }
 
-    std::unique_ptr<encode_dict> GetTiktokenEncoding(const std::string_view& name)
+    std::unique_ptr<BpeVocab> GetTiktokenEncoding(const std::string_view& name)
     {
+        //tables compiled into the library need no file at all
+        if (const EmbeddedEncoding* embedded = FindEmbeddedEncoding(name))
+            return LoadEmbeddedVocab(*embedded);
+
         std::string filename = std::string(name) + ".tiktoken";
         stdfs::path path = GetCacheFileFullPath(filename);
-        if (stdfs::exists(path))
+        stdfs::path binPath = GetCacheFileFullPath(std::string(name) + VOCAB_FILE_EXTENSION);
+        bool textExisted = stdfs::exists(path);
+
+        //prefer the mapped binary file, unless it is stale or broken
+        std::error_code ec;
+        if (stdfs::exists(binPath, ec))
+        {
+            std::optional<VocabSource> source = textExisted ? ReadVocabSource(path.string()) : std::nullopt;
+            const EncodingParam& param = Registry::GetEncodingParam(name);
+            std::unique_ptr<BpeVocab> vocab = LoadBinaryVocab(binPath.string(), param.special_tokens, source);
+            if (vocab != nullptr)
+                return vocab;
+        }
+
+        if (textExisted)
         {
             return LoadTiktokenBpe(path.string());
         }
@@ -48,6 +222,24 @@ namespace TiktokenCpp
         return nullptr;
     }
 
+    bool ConvertTiktokenToBinary(const std::string_view& name)
+    {
+        stdfs::path path = GetCacheFileFullPath(std::string(name) + ".tiktoken");
+        if (!stdfs::exists(path))
+            return false;
+
+        const EncodingParam& param = Registry::GetEncodingParam(name);
+        std::unique_ptr<BpeVocab> vocab = LoadTiktokenBpe(path.string());
+        std::optional<VocabSource> source = ReadVocabSource(path.string());
+        if (!source.has_value())
+            return false;
+        InitSystemEnv();
+        SaveBinaryVocab(*vocab, param.special_tokens, *source,
+            GetCacheFileFullPath(std::string(name) + VOCAB_FILE_EXTENSION).string());
+
+        return true;
+    }
+
     std::string EscapeRegex(const std::string& str)
     {
         std::regex specialChars{ R"([-[\]{}()*+?.,\^$|#\s])" };
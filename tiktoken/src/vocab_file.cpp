@@ -0,0 +1,158 @@
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include "MappedFile.h"
+#include "sys_env.h"
+#include "vocab_file.h"
+
+namespace TiktokenCpp
+{
+    static uint64_t AlignSection(uint64_t offset)
+    {
+        return (offset + 7) & ~uint64_t(7);
+    }
+
+    static void WriteSection(std::ofstream& file, const void* data, std::size_t size, uint64_t offset)
+    {
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+    }
+
+    std::optional<VocabSource> ReadVocabSource(const std::string& pathname)
+    {
+        MappedFile mapping;
+        if (!mapping.Open(pathname))
+            return std::nullopt;
+
+        //a change that keeps the size of the file changes its hash
+        return VocabSource{ mapping.Size(), VocabHashBytes(mapping.Bytes()) };
+    }
+
+    void SaveBinaryVocab(const BpeVocab& vocab, const StrViewToInt& specialTokens, const VocabSource& source, const std::string& pathname)
+    {
+        ByteSpan arena = vocab.ArenaBytes();
+        std::span<const uint32_t> offsets = vocab.RankOffsets();
+        std::span<const VocabSlot> slots = vocab.IndexSlots();
+        if (!vocab.Displacements().empty())
+            throw std::runtime_error("perfect hash index can not be saved to binary vocabulary file");
+
+        std::vector<VocabFileSpecial> specials;
+        std::string specialBytes;
+        for (const auto& special : specialTokens)
+        {
+            specials.push_back({ special.second, static_cast<uint32_t>(specialBytes.size()), static_cast<uint32_t>(special.first.size()), 0 });
+            specialBytes += special.first;
+        }
+
+        VocabFileHeader header{};
+        header.magic = VOCAB_FILE_MAGIC;
+        header.version = VOCAB_FILE_VERSION;
+        header.sourceSize = source.size;
+        header.sourceHash = source.hash;
+        header.tokenCount = vocab.Size();
+        header.rankCount = vocab.RankCount();
+        header.slotCount = slots.size();
+        header.arenaOffset = AlignSection(sizeof(VocabFileHeader));
+        header.arenaSize = arena.size();
+        header.offsetsOffset = AlignSection(header.arenaOffset + header.arenaSize);
+        header.slotsOffset = AlignSection(header.offsetsOffset + offsets.size_bytes());
+        header.specialOffset = AlignSection(header.slotsOffset + slots.size_bytes());
+        header.specialCount = specials.size();
+        header.specialBytesOffset = header.specialOffset + specials.size() * sizeof(VocabFileSpecial);
+        header.specialBytesSize = specialBytes.size();
+        header.fileSize = header.specialBytesOffset + header.specialBytesSize;
+
+        //write to a temporary file first, readers never see a half written file
+        std::string tmpname = pathname + ".tmp";
+        {
+            std::ofstream file(tmpname, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!file)
+                throw std::runtime_error("can not create binary vocabulary file: " + tmpname);
+
+            WriteSection(file, &header, sizeof(header), 0);
+            WriteSection(file, arena.data(), arena.size(), header.arenaOffset);
+            WriteSection(file, offsets.data(), offsets.size_bytes(), header.offsetsOffset);
+            WriteSection(file, slots.data(), slots.size_bytes(), header.slotsOffset);
+            WriteSection(file, specials.data(), specials.size() * sizeof(VocabFileSpecial), header.specialOffset);
+            WriteSection(file, specialBytes.data(), specialBytes.size(), header.specialBytesOffset);
+            if (!file.flush())
+                throw std::runtime_error("fail to write binary vocabulary file: " + tmpname);
+        }
+
+        std::error_code ec;
+        stdfs::rename(tmpname, pathname, ec);
+        if (ec)
+        {
+            stdfs::remove(tmpname, ec);
+            throw std::runtime_error("fail to write binary vocabulary file: " + pathname);
+        }
+    }
+
+    static bool IsSectionValid(const VocabFileHeader& header, uint64_t offset, uint64_t size)
+    {
+        return ((offset % 8) == 0) && (offset <= header.fileSize) && (size <= header.fileSize - offset);
+    }
+
+    static bool IsSpecialTokensMatched(const VocabFileHeader& header, const uint8_t* base, const StrViewToInt& specialTokens)
+    {
+        if (header.specialCount != specialTokens.size())
+            return false;
+
+        const VocabFileSpecial* specials = reinterpret_cast<const VocabFileSpecial*>(base + header.specialOffset);
+        const char* bytes = reinterpret_cast<const char*>(base + header.specialBytesOffset);
+        for (uint64_t i = 0; i < header.specialCount; i++)
+        {
+            const VocabFileSpecial& special = specials[i];
+            if ((special.offset > header.specialBytesSize) || (special.length > header.specialBytesSize - special.offset))
+                return false;
+
+            auto it = specialTokens.find(std::string_view(bytes + special.offset, special.length));
+            if ((it == specialTokens.end()) || (it->second != special.token))
+                return false;
+        }
+
+        return true;
+    }
+
+    std::unique_ptr<BpeVocab> LoadBinaryVocab(const std::string& pathname, const StrViewToInt& specialTokens,
+                                              const std::optional<VocabSource>& source)
+    {
+        auto mapping = std::make_shared<MappedFile>();
+        if (!mapping->Open(pathname) || (mapping->Size() < sizeof(VocabFileHeader)))
+            return nullptr;
+
+        const uint8_t* base = mapping->Data();
+        VocabFileHeader header;
+        std::memcpy(&header, base, sizeof(header));
+        if ((header.magic != VOCAB_FILE_MAGIC) || (header.version != VOCAB_FILE_VERSION) || (header.fileSize != mapping->Size()))
+            return nullptr;
+        if (source.has_value() && ((header.sourceSize != source->size) || (header.sourceHash != source->hash)))
+            return nullptr; //stale, the .tiktoken file was replaced or edited
+
+        if (!IsSectionValid(header, header.arenaOffset, header.arenaSize) ||
+            !IsSectionValid(header, header.offsetsOffset, (header.rankCount + 1) * sizeof(uint32_t)) ||
+            !IsSectionValid(header, header.slotsOffset, header.slotCount * sizeof(VocabSlot)) ||
+            !IsSectionValid(header, header.specialOffset, header.specialCount * sizeof(VocabFileSpecial)) ||
+            (header.specialBytesOffset < header.specialOffset) ||
+            (header.specialBytesOffset > header.fileSize) || (header.specialBytesSize > header.fileSize - header.specialBytesOffset))
+            return nullptr;
+
+        if (!IsSpecialTokensMatched(header, base, specialTokens))
+            return nullptr;
+
+        auto vocab = std::make_unique<BpeVocab>();
+        try
+        {
+            vocab->Attach(ByteSpan(base + header.arenaOffset, header.arenaSize),
+                std::span<const uint32_t>(reinterpret_cast<const uint32_t*>(base + header.offsetsOffset), header.rankCount + 1),
+                std::span<const VocabSlot>(reinterpret_cast<const VocabSlot*>(base + header.slotsOffset), header.slotCount),
+                header.tokenCount, mapping);
+        }
+        catch (const std::runtime_error&)
+        {
+            return nullptr;
+        }
+
+        return vocab;
+    }
+}
@@ -1,9 +1,21 @@
 #include <iostream>
+#include <fstream>
 #include <filesystem>
 #include <vector>
+#include <random>
+#include <algorithm>
 #include <cassert>
+#include <thread>
+#include <limits>
 #include "Utf8String.h"
 #include "tiktoken.h"
+#include "registry.h"
+#include "pretokenizer.h"
+#include "core_bpe.h"
+#include "utils.h"
+#include "vocab_file.h"
+#include "embedded_encoding.h"
+#include "sys_env.h"
 #include "Timer.h"
 
 using namespace std::literals;
@@ -39,6 +51,544 @@ std::ostream& PrintSymbols(std::ostream& os, const std::vector<std::string>& sym
     return os;
 }
 
+static void AppendUtf8(std::string& text, uint32_t cp)
+{
+    if (cp < 0x80)
+        text += static_cast<char>(cp);
+    else if (cp < 0x800)
+    {
+        text += static_cast<char>(0xC0 | (cp >> 6));
+        text += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        text += static_cast<char>(0xE0 | (cp >> 12));
+        text += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        text += static_cast<char>(0xF0 | (cp >> 18));
+        text += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        text += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        text += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+//piece ends of text, a 0 marks a position the pattern does not match
+static std::vector<std::size_t> SplitPieces(const Pretokenizer& pretokenizer, const std::string& text)
+{
+    std::vector<std::size_t> ends;
+    for (std::size_t pos = 0; pos < text.size();)
+    {
+        std::size_t end = pretokenizer.NextPiece(text, pos);
+        ends.push_back((end == pos) ? 0 : end);
+        if (end == pos)
+            break;
+        pos = end;
+    }
+
+    return ends;
+}
+
+//PCRE2 JIT, the generated DFA and the hand-written scanner of every split pattern must agree with PCRE2
+static void SplitDifferentialTest(const std::vector<std::string>& samples)
+{
+    //ASCII that the patterns name, whitespace variants and some non-ASCII letters, numbers and marks
+    const std::vector<uint32_t> alphabet = { 'a', 'Z', 's', 'S', 't', 'r', 'e', 'v', 'm', 'l', 'L', 'd', 'k', '\'', '\'', ' ', ' ', ' ',
+        '\t', '\n', '\r', '\v', '\f', '0', '7', '!', '.', '-', 0x17F, 0x212A, 0x85, 0xA0, 0x1680, 0x2000, 0x2028, 0x3000,
+        0x4E2D, 0x3042, 0xE9, 0x301, 0x660, 0xBC, 0x2160, 0x1F600, 0xFF10, 0x3002, 0x200B };
+    std::mt19937 rng(12345);
+
+    std::vector<std::string_view> patterns;
+    for (const auto& name : ListEncodingNames())
+    {
+        std::string_view pattern = Registry::GetEncodingParam(name).pat_str;
+        if (std::find(patterns.begin(), patterns.end(), pattern) == patterns.end())
+            patterns.push_back(pattern);
+    }
+
+    for (const auto& pattern : patterns)
+    {
+        auto regex = CreateRegexPretokenizer(pattern);
+        auto jit = CreateRegexPretokenizer(pattern, true);
+        auto generated = CreateGeneratedPretokenizer(pattern);
+        auto handWritten = CreateHandWrittenPretokenizer(pattern);
+
+        std::size_t texts = 0, mismatches = 0;
+        auto check = [&](const std::string& text)
+        {
+            std::vector<std::size_t> expected = SplitPieces(*regex, text);
+            texts++;
+            if ((SplitPieces(*jit, text) != expected)
+                || ((generated != nullptr) && (SplitPieces(*generated, text) != expected))
+                || ((handWritten != nullptr) && (SplitPieces(*handWritten, text) != expected)))
+                mismatches++;
+        };
+
+        for (const auto& sample : samples)
+            check(sample);
+        for (int round = 0; round < 20000; round++)
+        {
+            std::string text;
+            std::size_t length = rng() % 24;
+            for (std::size_t i = 0; i < length; i++)
+            {
+                uint32_t cp = (rng() % 10 == 0) ? (rng() % 0x30000) : alphabet[rng() % alphabet.size()];
+                AppendUtf8(text, ((cp >= 0xD800) && (cp < 0xE000)) ? 'q' : cp);
+            }
+            check(text);
+        }
+
+        std::cout << "Split test for " << pattern << ": " << texts << " texts, generated DFA "
+            << ((generated != nullptr) ? "checked" : "not built") << ", hand-written scanner "
+            << ((handWritten != nullptr) ? "checked" : "not available") << ", " << mismatches << " mismatches" << std::endl;
+        assert(mismatches == 0);
+    }
+}
+
+static void SplitBenchmark(const std::string& text)
+{
+    std::string_view pattern = Registry::GetEncodingParam("cl100k_base").pat_str;
+    std::vector<std::pair<const char*, std::unique_ptr<const Pretokenizer>>> scanners;
+    scanners.emplace_back("PCRE2", CreateRegexPretokenizer(pattern));
+    scanners.emplace_back("PCRE2 JIT", CreateRegexPretokenizer(pattern, true));
+    scanners.emplace_back("generated DFA", CreateGeneratedPretokenizer(pattern));
+    scanners.emplace_back("hand-written", CreateHandWrittenPretokenizer(pattern));
+
+    for (const auto& [name, scanner] : scanners)
+    {
+        if (scanner == nullptr)
+            continue;
+
+        std::size_t pieces = 0;
+        Timer st(true);
+        for (int round = 0; round < 20; round++)
+            pieces += SplitPieces(*scanner, text).size();
+        std::cout << "Split time (" << name << "): " << st.GetMS() << ", " << pieces / 20 << " pieces of "
+            << text.size() << " bytes" << std::endl;
+    }
+}
+
+//EncodeOrdinaryParallel with tiny parts must give the tokens of EncodeOrdinary, one encoding of every split pattern
+static void ParallelDifferentialTest()
+{
+    //runs of newlines and whitespace before them, contractions, digits and non-ASCII around the cut
+    const std::vector<std::string> fragments = { "\n", "\n\n", "\r\n", " \n", "\t\n", " ", "  ", "a", "Zb", "s",
+        "'s", "'ll", "'", "x\n", ".\n", "!\n\n", "?\r\n", "-", "0", "123", "4567", "\xC3\xA9", "\xE4\xB8\xAD",
+        "\xF0\x9F\x98\x80", "\xC2\xA0", "\xE2\x80\xA8", "ab\ncd", "}\nif", "  \n  x", "\n'", "\nS" };
+    std::mt19937 rng(54321);
+
+    std::vector<std::string_view> patterns;
+    for (const auto& name : ListEncodingNames())
+    {
+        std::string_view pattern = Registry::GetEncodingParam(name).pat_str;
+        if (std::find(patterns.begin(), patterns.end(), pattern) != patterns.end())
+            continue;
+        patterns.push_back(pattern);
+
+        std::shared_ptr<const TikToken> encoding = GetEncoding(name);
+        auto regex = CreateRegexPretokenizer(pattern, true);
+        std::size_t texts = 0, mismatches = 0;
+        for (int round = 0; round < 2000; round++)
+        {
+            std::string text;
+            std::size_t count = rng() % 200;
+            for (std::size_t i = 0; i < count; i++)
+                text += fragments[rng() % fragments.size()];
+
+            //pieces must not cross a resync point, even where the tokens would hide it
+            if (HasResyncPoints(pattern))
+            {
+                std::vector<std::size_t> expected = SplitPieces(*regex, text);
+                for (std::size_t cut = FindResyncPoint(text, 0); cut != std::string_view::npos; cut = FindResyncPoint(text, cut + 1))
+                {
+                    std::vector<std::size_t> pieces = SplitPieces(*regex, text.substr(0, cut));
+                    for (std::size_t end : SplitPieces(*regex, text.substr(cut)))
+                        pieces.push_back((end == 0) ? 0 : cut + end);
+                    texts++;
+                    if (pieces != expected)
+                        mismatches++;
+                }
+            }
+
+            std::vector<uint32_t> expected = encoding->EncodeOrdinary(text);
+            for (std::size_t chunkBytes : { 1, 2, 3, 7, 64 })
+            {
+                texts++;
+                if (encoding->EncodeOrdinaryParallel(text, chunkBytes) != expected)
+                    mismatches++;
+            }
+        }
+
+        std::cout << "Parallel test for " << name << ": " << texts << " texts, " << mismatches << " mismatches" << std::endl;
+        assert(mismatches == 0);
+    }
+}
+
+//encodings are shared, loaded once by concurrent first calls, and released only when nobody holds them
+static void EncodingCacheTest()
+{
+    ReleaseIdleEncodings(); //start cold
+
+    std::vector<std::shared_ptr<const TikToken>> loaded(4);
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < loaded.size(); i++)
+        threads.emplace_back([&loaded, i]() { loaded[i] = GetEncoding("r50k_base"); });
+    for (auto& thread : threads)
+        thread.join();
+    std::shared_ptr<const TikToken> r50k = loaded[0];
+    assert(std::all_of(loaded.begin(), loaded.end(), [&r50k](const auto& encoding) { return encoding == r50k; }));
+    loaded.clear();
+
+    std::shared_ptr<const TikToken> cl100k = GetEncoding("cl100k_base");
+    assert(GetEncoding("r50k_base") == r50k);
+    assert(EncodingForModel("gpt-4") == cl100k);
+    assert(EncodingForModel("gpt-3.5-turbo") == EncodingForModel("gpt-4"));
+
+    //held handles keep their entries, a dropped one is released
+    std::size_t heldReleased = ReleaseIdleEncodings();
+    std::weak_ptr<const TikToken> cl100kWeak = cl100k;
+    cl100k.reset();
+    std::size_t droppedReleased = ReleaseIdleEncodings();
+    assert((heldReleased == 0) && (droppedReleased == 1) && cl100kWeak.expired());
+
+    //a tiny budget evicts what is not held and keeps what is
+    cl100k = GetEncoding("cl100k_base");
+    cl100kWeak = cl100k;
+    cl100k.reset();
+    SetEncodingCacheBudget(1);
+    assert(cl100kWeak.expired());
+    assert(GetEncoding("r50k_base") == r50k);
+    SetEncodingCacheBudget(std::numeric_limits<std::size_t>::max());
+    r50k.reset();
+    std::size_t lastReleased = ReleaseIdleEncodings();
+    assert(lastReleased == 1);
+
+    std::cout << "Encoding cache test: shared, loaded once by " << threads.size() << " threads, released "
+        << heldReleased << " while held, " << droppedReleased << " when dropped, " << lastReleased << " after budget eviction" << std::endl;
+}
+
+static std::string ReadTestFile(const stdfs::path& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static void WriteTestFile(const stdfs::path& path, const std::string& content)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(content.data(), static_cast<std::streamsize>(content.size()));
+}
+
+//a converted .tkbin gives the tokens of the .tiktoken file, and is ignored when stale or damaged
+static void BinaryVocabTest()
+{
+    const std::string_view name = "r50k_base";
+    const stdfs::path source = GetCacheFileFullPath(std::string(name) + ".tiktoken");
+    const stdfs::path binary = GetCacheFileFullPath(std::string(name) + VOCAB_FILE_EXTENSION);
+    if ((FindEmbeddedEncoding(name) != nullptr) || !stdfs::exists(source))
+    {
+        std::cout << "Binary vocabulary test skipped: " << name << " is embedded or not downloaded" << std::endl;
+        return;
+    }
+    const StrViewToInt& specials = Registry::GetEncodingParam(name).special_tokens;
+    const bool hadBinary = stdfs::exists(binary);
+    const std::string original = ReadTestFile(source);
+    const std::string sample = "hello world, tiktoken is great! \xF0\x9F\x98\x80 <|endoftext|>";
+    auto binaryUsable = [&]() {
+        return LoadBinaryVocab(binary.string(), specials, ReadVocabSource(source.string())) != nullptr;
+    };
+    //drop the cached encoding before and after, so each check loads the files again and nothing keeps them mapped
+    auto withEncoding = [&](const auto& check) {
+        ReleaseIdleEncodings();
+        check(*GetEncoding(name));
+        ReleaseIdleEncodings();
+    };
+
+    //two lines near the end with tokens of the same length, swapping them keeps the file size
+    std::vector<std::pair<std::size_t, std::size_t>> lines; //(token offset, token length)
+    for (std::size_t begin = 0; begin < original.size();)
+    {
+        std::size_t end = original.find('\n', begin);
+        if (end == std::string::npos)
+            end = original.size();
+        std::size_t space = original.find(' ', begin);
+        if (space < end)
+            lines.emplace_back(begin, space - begin);
+        begin = end + 1;
+    }
+    std::size_t first = lines.size() - 2;
+    while ((first > 0) && (lines[first].second != lines.back().second))
+        first--;
+    const uint32_t firstRank = static_cast<uint32_t>(first), lastRank = static_cast<uint32_t>(lines.size() - 1);
+    std::string edited = original;
+    edited.replace(lines[first].first, lines[first].second, original, lines.back().first, lines.back().second);
+    edited.replace(lines.back().first, lines.back().second, original, lines[first].first, lines[first].second);
+
+    stdfs::remove(binary);
+    std::vector<uint32_t> textTokens;
+    std::string lastBytes;
+    withEncoding([&](const TikToken& encoding) {
+        textTokens = encoding.Encode(sample, "all");
+        lastBytes = encoding.Decode({ lastRank });
+    });
+
+    //converted
+    bool converted = ConvertEncodingToBinary(name) && binaryUsable();
+    bool binarySame = false;
+    withEncoding([&](const TikToken& encoding) {
+        binarySame = (encoding.Encode(sample, "all") == textTokens) && (encoding.Decode(textTokens) == sample);
+    });
+
+    //same size edit of the .tiktoken file
+    WriteTestFile(source, edited);
+    bool staleIgnored = (stdfs::file_size(source) == original.size()) && !binaryUsable();
+    withEncoding([&](const TikToken& encoding) { staleIgnored = staleIgnored && (encoding.Decode({ firstRank }) == lastBytes); });
+    WriteTestFile(source, original);
+
+    //truncated header, corrupted magic and an out of range section
+    std::size_t fallbacks = 0;
+    auto checkFallback = [&](const auto& damage) {
+        ConvertEncodingToBinary(name);
+        damage();
+        bool fellBack = !binaryUsable();
+        withEncoding([&](const TikToken& encoding) { fellBack = fellBack && (encoding.Encode(sample, "all") == textTokens); });
+        fallbacks += fellBack ? 1 : 0;
+    };
+    checkFallback([&]() { stdfs::resize_file(binary, sizeof(VocabFileHeader) / 2); });
+    auto patch = [&](std::size_t offset, const auto& value) {
+        std::fstream file(binary, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    };
+    checkFallback([&]() { patch(offsetof(VocabFileHeader, magic), uint32_t(0)); });
+    checkFallback([&]() { patch(offsetof(VocabFileHeader, arenaOffset), std::numeric_limits<uint64_t>::max() - 7); });
+
+    if (hadBinary)
+        ConvertEncodingToBinary(name);
+    else
+        stdfs::remove(binary);
+
+    std::cout << "Binary vocabulary test: converted " << converted << ", same tokens " << binarySame
+        << ", same size edit (ranks " << firstRank << " and " << lastRank << ") ignored " << staleIgnored
+        << ", damaged files fell back " << fallbacks << "/3" << std::endl;
+    assert(converted && binarySame && staleIgnored && (fallbacks == 3));
+}
+
+static void AppendWide(std::wstring& text, uint32_t cp)
+{
+    if ((sizeof(wchar_t) == 2) && (cp >= 0x10000))
+    {
+        text += static_cast<wchar_t>(0xD800 + ((cp - 0x10000) >> 10));
+        text += static_cast<wchar_t>(0xDC00 + ((cp - 0x10000) & 0x3FF));
+    }
+    else
+        text += static_cast<wchar_t>(cp);
+}
+
+//UTF-8 <-> wide conversions of common/Utf8String.cpp, around the 16 character blocks of its ASCII fast paths
+static void TranscodingTest()
+{
+    std::size_t cases = 0, failures = 0;
+    auto roundTrip = [&](const std::string& utf8, const std::wstring& wide) {
+        cases++;
+        if ((WideFromUTF8(utf8) != wide) || (UTF16LEStrFromUTF8(utf8) != wide) || (UTF8FromUTF16LEStr(wide) != utf8))
+            failures++;
+    };
+
+    //ASCII runs shorter and longer than a block, alone and followed by other characters
+    for (uint32_t tail : { 0u, 0xE9u, 0x4E2Du, 0x1F600u })
+    {
+        for (std::size_t length = 0; length <= 50; length++)
+        {
+            std::string utf8;
+            std::wstring wide;
+            for (std::size_t i = 0; i < length; i++)
+            {
+                AppendUtf8(utf8, 'a' + i % 26);
+                AppendWide(wide, 'a' + i % 26);
+            }
+            if (tail != 0)
+            {
+                AppendUtf8(utf8, tail);
+                AppendWide(wide, tail);
+                utf8 += "tail";
+                wide += L"tail";
+            }
+            roundTrip(utf8, wide);
+        }
+    }
+
+    //BMP and supplementary characters at every position of a block, so surrogate pairs of
+    //16 bit wchar_t also straddle the end of the 16 units scanned after an ASCII run
+    const uint32_t mixed[] = { 0xE9, 0x4E2D, 0x1F600, 0xFFFD, 0x10FFFF, 0x10000, 0x7FF, 0x800, 0xFFFF };
+    for (std::size_t prefix = 0; prefix <= 40; prefix++)
+    {
+        std::string utf8;
+        std::wstring wide;
+        for (std::size_t i = 0; i < prefix; i++)
+        {
+            utf8 += 'x';
+            wide += L'x';
+        }
+        for (std::size_t i = 0; i < 40; i++)
+        {
+            uint32_t cp = mixed[(prefix + i) % std::size(mixed)];
+            AppendUtf8(utf8, cp);
+            AppendWide(wide, cp);
+        }
+        roundTrip(utf8, wide);
+    }
+
+    //lone surrogates and invalid UTF-8 become U+FFFD, one per unit or byte that can not be used
+    const std::string replacement = "\xEF\xBF\xBD";
+    const std::string ascii(20, 'y');
+    const std::wstring wideAscii(20, L'y');
+    std::size_t replaced = 0;
+    auto toUtf8 = [&](const std::wstring& wide, const std::string& expected) {
+        cases++;
+        replaced++;
+        failures += (UTF8FromUTF16LEStr(wide) == expected) ? 0 : 1;
+    };
+    for (const std::wstring& lead : { std::wstring(), wideAscii })
+    {
+        const std::string utf8Lead(lead.begin(), lead.end());
+        toUtf8(lead + static_cast<wchar_t>(0xD800) + L"b", utf8Lead + replacement + "b");
+        toUtf8(lead + static_cast<wchar_t>(0xDC00) + L"b", utf8Lead + replacement + "b");
+        toUtf8(lead + static_cast<wchar_t>(0xDBFF), utf8Lead + replacement);
+        toUtf8(lead + static_cast<wchar_t>(0xDC00) + static_cast<wchar_t>(0xD800), utf8Lead + replacement + replacement);
+    }
+    auto toWide = [&](const std::string& utf8, std::size_t replacements) {
+        cases++;
+        replaced++;
+        std::wstring expected = L"a";
+        expected.append(replacements, static_cast<wchar_t>(0xFFFD));
+        expected += L"b";
+        failures += (WideFromUTF8("a" + utf8 + "b") == expected) ? 0 : 1;
+        std::wstring longExpected = wideAscii + expected;
+        failures += (WideFromUTF8(ascii + "a" + utf8 + "b") == longExpected) ? 0 : 1;
+    };
+    toWide("\xFF", 1);
+    toWide("\x80", 1);
+    toWide("\xC0\x80", 2);             //overlong
+    toWide("\xE4\xB8", 2);             //truncated
+    toWide("\xED\xA0\x80", 3);         //encoded surrogate
+    toWide("\xF4\x90\x80\x80", 4);     //above U+10FFFF
+    toWide("\xF0\x9F\x98", 3);         //truncated supplementary character
+
+    //the BOM of UTF16StrFromLocalMBCS is dropped again by LocalMBCSFromUTF16Str, which takes text without it as well
+    const std::string local = "plain ASCII text, longer than one block of sixteen characters";
+    std::wstring withBom = UTF16StrFromLocalMBCS(local);
+    bool bom = (withBom.size() == local.size() + 1) && (withBom[0] == static_cast<wchar_t>(0xFEFF))
+        && (withBom.substr(1) == std::wstring(local.begin(), local.end()))
+        && (LocalMBCSFromUTF16Str(withBom) == local) && (LocalMBCSFromUTF16Str(withBom.substr(1)) == local)
+        && (UTF16LEStrFromLocalMBCS(local) == withBom.substr(1)) && (LocalMBCSFromUTF16LEStr(withBom.substr(1)) == local);
+    cases++;
+    failures += bom ? 0 : 1;
+
+    std::cout << "Transcoding test: " << cases << " cases (" << replaced << " with U+FFFD), " << failures << " failures" << std::endl;
+    assert(failures == 0);
+}
+
+//pieces out of the vocabulary are served from the cache once seen, a capped cache stays
+//under its limit, and a disabled one is empty; the tokens are the same either way
+static void PieceCacheTest()
+{
+    TikToken encoding(Registry::GetEncodingParam("cl100k_base")); //own cache, untouched by other tests
+    std::mt19937 rng(4242);
+    auto randomWords = [&rng](std::size_t count) {
+        std::string text;
+        for (std::size_t i = 0; i < count; i++)
+        {
+            text += ' ';
+            for (std::size_t length = 8 + rng() % 8; length > 0; length--)
+                text += static_cast<char>('a' + rng() % 26);
+        }
+        return text;
+    };
+
+    std::string repetitive;
+    const std::string words = randomWords(200);
+    for (int i = 0; i < 5; i++)
+        repetitive += words;
+    std::vector<uint32_t> cached = encoding.EncodeOrdinary(repetitive);
+    PieceCacheStats first = encoding.GetPieceCacheStats();
+    bool again = encoding.EncodeOrdinary(repetitive) == cached;
+    PieceCacheStats second = encoding.GetPieceCacheStats();
+    bool warm = again && (first.misses > 0) && (first.hits > 0) && (second.hits > first.hits) && (second.misses == first.misses);
+
+    //a tiny limit evicts, memory stays under it
+    const std::string distinct = randomWords(5000);
+    std::vector<uint32_t> distinctTokens = encoding.EncodeOrdinary(distinct);
+    const std::size_t tinyLimit = 16 * 1024;
+    encoding.SetPieceCacheLimit(tinyLimit);
+    bool tinySame = (encoding.EncodeOrdinary(distinct) == distinctTokens) && (encoding.EncodeOrdinary(repetitive) == cached);
+    PieceCacheStats tiny = encoding.GetPieceCacheStats();
+    bool capped = tinySame && (tiny.entries > 0) && (tiny.memory <= tiny.limit) && (tiny.limit <= tinyLimit);
+
+    //0 empties and disables the cache, nothing is counted any more
+    encoding.SetPieceCacheLimit(0);
+    PieceCacheStats disabled = encoding.GetPieceCacheStats();
+    bool uncachedSame = (encoding.EncodeOrdinary(repetitive) == cached) && (encoding.EncodeOrdinary(distinct) == distinctTokens);
+    PieceCacheStats after = encoding.GetPieceCacheStats();
+    bool off = uncachedSame && (disabled.entries == 0) && (disabled.memory == 0) && (disabled.limit == 0)
+        && (after.entries == 0) && (after.hits == disabled.hits) && (after.misses == disabled.misses);
+
+    std::cout << "Piece cache test: second pass hits " << (second.hits - first.hits) << ", misses " << (second.misses - first.misses)
+        << " (warm " << warm << "); tiny limit " << tiny.entries << " entries, " << tiny.memory << "/" << tiny.limit
+        << " bytes (capped " << capped << "); disabled " << after.entries << " entries (off " << off << ")" << std::endl;
+    assert(warm && capped && off);
+}
+
+//the heap merge of long pieces must give the tokens of the linear scan merge
+static void MergeDifferentialTest(const std::shared_ptr<const TikToken>& encoding)
+{
+    const EncodingParam& param = Registry::GetEncodingParam("cl100k_base");
+    CoreBpe bpe(GetTiktokenEncoding(param.name), param.special_tokens, param.pat_str);
+    std::mt19937 rng(777);
+
+    //letter runs are one piece of the pattern, EncodeOrdinary merges them with the heap
+    std::vector<std::pair<std::string, bool>> pieces; //(piece, one piece of the pattern)
+    for (std::size_t length : { 256, 257, 300, 511, 512, 1000, 1500, 2000 })
+    {
+        std::string letters, narrow;
+        for (std::size_t i = 0; i < length; i++)
+        {
+            letters += static_cast<char>('a' + rng() % 26);
+            narrow += "etaoin"[rng() % 6];
+        }
+        pieces.emplace_back(letters, true);
+        pieces.emplace_back(narrow, true);
+    }
+    std::string ab, a, cjk, latin, bytes;
+    for (int i = 0; i < 600; i++)
+        ab += "ab";
+    a.assign(1000, 'a');
+    for (int i = 0; i < 400; i++)
+    {
+        AppendUtf8(cjk, 0x4E00 + rng() % 0x5000);
+        AppendUtf8(latin, 0xC0 + rng() % 0x40);
+        bytes += static_cast<char>(rng() % 256);
+    }
+    pieces.emplace_back(ab, true);
+    pieces.emplace_back(a, true);
+    pieces.emplace_back(cjk, true);
+    pieces.emplace_back(latin, false);
+    pieces.emplace_back(bytes, false);
+
+    std::size_t mismatches = 0;
+    for (const auto& [piece, single] : pieces)
+    {
+        assert(piece.size() >= LARGE_PIECE_THRESHOLD);
+        std::vector<uint32_t> linear = bpe.MergePiece(ToByteSpan(piece), false);
+        if ((bpe.MergePiece(ToByteSpan(piece), true) != linear) || (single && (encoding->EncodeOrdinary(piece) != linear)))
+            mismatches++;
+    }
+
+    std::cout << "Merge test: " << pieces.size() << " long pieces, " << mismatches << " mismatches" << std::endl;
+    assert(mismatches == 0);
+}
 
 int main()
 {
@@ -62,6 +612,10 @@ int main()
         std::cout << "Downloading exception occured" << std::endl;
     }
 
+    EncodingCacheTest();
+    BinaryVocabTest();
+    TranscodingTest();
+
     //Testing data:
     std::vector<std::string> texts = {
         {"hello world"},
@@ -82,8 +636,8 @@ int main()
     };
 
     //Get encoding object, using "cl100k_base" encoding file
-    std::unique_ptr<TikToken> encoding = GetEncoding("cl100k_base");
-    //std::unique_ptr<TikToken> encoding = EncodingForModel("GPT-4");
+    std::shared_ptr<const TikToken> encoding = GetEncoding("cl100k_base");
+    //std::shared_ptr<const TikToken> encoding = EncodingForModel("GPT-4");
 
     //std::string tes = "Hello, 中国 😀";
     //std::string lotes = LocalMBCSFromUTF8Str(tes);
@@ -103,6 +657,54 @@ int main()
         assert(dec_result == texts[i]);
     }
 
+    MergeDifferentialTest(encoding);
+    PieceCacheTest();
+
+    //split phase: every scanner against PCRE2, then their speed on the test texts
+    SplitDifferentialTest(texts);
+    std::string splitText;
+    while (splitText.size() < (1u << 20))
+    {
+        for (const auto& text : texts)
+            splitText += text + "\n";
+    }
+    SplitBenchmark(splitText);
+
+    //batch phase: many small documents, one at a time and spread over the shared thread pool
+    std::vector<std::string_view> documents;
+    for (int round = 0; round < 20000; round++)
+        documents.insert(documents.end(), texts.begin(), texts.end());
+    Timer bt(true);
+    std::vector<std::vector<uint32_t>> oneByOne;
+    for (const auto& document : documents)
+        oneByOne.push_back(encoding->EncodeOrdinary(std::string(document)));
+    auto serialTime = bt.GetMS();
+    bt.Start();
+    auto batchTokens = encoding->EncodeBatch(documents);
+    auto batchTime = bt.GetMS();
+    TokenBatch flatTokens = encoding->EncodeBatchFlat(documents);
+    assert(batchTokens == oneByOne);
+    assert(flatTokens.offsets.back() == flatTokens.tokens.size());
+    auto batchTexts = encoding->DecodeBatch(flatTokens);
+    assert(std::equal(batchTexts.begin(), batchTexts.end(), documents.begin(), documents.end()));
+    std::cout << "Encode time of " << documents.size() << " documents (one by one): " << serialTime
+        << ", (EncodeBatch): " << batchTime << std::endl;
+
+    //one large document, serially and in parts cut at resync points
+    ParallelDifferentialTest();
+    std::string largeText;
+    while (largeText.size() < (8u << 20))
+        largeText += "int main()\n{\n    return 0;\n}\nThe quick brown fox jumps over the lazy dog.\nHi，试一下中文字符！\n";
+    bt.Start();
+    auto serialTokens = encoding->EncodeOrdinary(largeText);
+    serialTime = bt.GetMS();
+    bt.Start();
+    auto parallelTokens = encoding->EncodeOrdinaryParallel(largeText);
+    auto parallelTime = bt.GetMS();
+    assert(parallelTokens == serialTokens);
+    std::cout << "Encode time of " << largeText.size() << " bytes (serial): " << serialTime
+        << ", (EncodeOrdinaryParallel): " << parallelTime << std::endl;
+
     //For special text
     std::string text = "hello <|endoftext|>";
     std::cout << "Encoding: \"" << text << "\", with allowedSpecial: all , disallowedSpecial: all" << std::endl;
@@ -136,6 +738,133 @@ int main()
     dec = encoding->Decode(enc);
     assert(dec == text);
 
+    //Precompiled options, resolved once and reused for every call
+    EncodeOptions endOfText(*encoding, "<|endoftext|>");
+    text = "hello <|endoftext|>";
+    std::cout << "Encoding: \"" << text << "\", with EncodeOptions allowing <|endoftext|>" << std::endl;
+    enc = encoding->Encode(text, endOfText);
+    PrintTokens(std::cout, enc);
+    spec1 = { 15339, 220, 100257 };
+    assert(enc == spec1);
+    bool disallowedThrown = false;
+    try
+    {
+        encoding->Encode("<|fim_prefix|>", endOfText);
+    }
+    catch (const std::runtime_error&)
+    {
+        disallowedThrown = true;
+    }
+    std::cout << "Encoding: \"<|fim_prefix|>\", with EncodeOptions allowing <|endoftext|>: "
+        << (disallowedThrown ? "rejected" : "not rejected") << std::endl;
+    if (!disallowedThrown)
+        return 1;
+
+    Timer optionsTimer(true);
+    for (int round = 0; round < 100000; round++)
+        enc = encoding->Encode(text, "<|endoftext|>");
+    auto setupTime = optionsTimer.GetMS();
+    optionsTimer.Start();
+    for (int round = 0; round < 100000; round++)
+        enc = encoding->Encode(text, endOfText);
+    std::cout << "Encode time (special sets per call): " << setupTime << ", (EncodeOptions): " << optionsTimer.GetMS() << std::endl;
+
+    //invalid UTF-8 is encoded byte level and decoded back unchanged
+    text = "hello \xff world \xe4\xb8";
+    std::cout << "Encoding invalid UTF-8 \"hello \\xff world \\xe4\\xb8\"" << std::endl;
+    enc = encoding->EncodeOrdinary(text);
+    PrintTokens(std::cout, enc);
+    assert(encoding->Decode(enc) == text);
+
+    //wide text gives the same tokens as its UTF-8 form
+    std::wstring wideText = L"hello <|endoftext|> \u4f60\u597d \U0001F600";
+    enc = encoding->Encode(wideText, endOfText);
+    PrintTokens(std::cout, enc);
+    std::string wideUtf8;
+    AppendUTF8FromWide(wideText, wideUtf8);
+    assert(enc == encoding->Encode(wideUtf8, endOfText));
+
+    //offsets cover the text token by token, UTF-16 offsets end at its UTF-16 length
+    TokenOffsets offsets = encoding->EncodeWithOffsets(wideUtf8, endOfText, true);
+    assert(offsets.tokens == encoding->Encode(wideUtf8, endOfText));
+    for (std::size_t i = 0; i < offsets.tokens.size(); i++)
+    {
+        assert(offsets.bytes[i].first == ((i == 0) ? 0 : offsets.bytes[i - 1].second));
+        assert(encoding->Decode({ offsets.tokens[i] }) == wideUtf8.substr(offsets.bytes[i].first, offsets.bytes[i].second - offsets.bytes[i].first));
+    }
+    std::size_t utf16Length = 0;
+    for (wchar_t c : wideText)
+        utf16Length += ((sizeof(wchar_t) > 2) && (static_cast<uint32_t>(c) > 0xFFFF)) ? 2 : 1;
+    assert(offsets.bytes.back().second == wideUtf8.size());
+    assert(offsets.utf16.back().second == utf16Length);
+    std::string invalidText = "hello \xff world \xe4\xb8";
+    assert(encoding->EncodeOrdinaryWithOffsets(invalidText).bytes.back().second == invalidText.size());
+
+    //encoding into a reused vector, a span and a sink gives the same tokens
+    std::vector<uint32_t> reused = { 1 };
+    encoding->EncodeInto(wideUtf8, endOfText, reused);
+    assert(std::equal(reused.begin() + 1, reused.end(), enc.begin(), enc.end()));
+    std::vector<uint32_t> fixedBuffer(4);
+    assert(encoding->EncodeInto(wideUtf8, endOfText, std::span<uint32_t>(fixedBuffer)) == enc.size());
+    assert(std::equal(fixedBuffer.begin(), fixedBuffer.end(), enc.begin()));
+    for (const std::string& spanText : { largeText.substr(0, 65536), invalidText })
+    {
+        std::vector<uint32_t> spanAll = encoding->EncodeOrdinary(spanText);
+        std::vector<uint32_t> half(spanAll.size() / 2), roomy(spanAll.size() + 1);
+        assert(encoding->EncodeOrdinaryInto(spanText, std::span<uint32_t>(half)) == spanAll.size());
+        assert(std::equal(half.begin(), half.end(), spanAll.begin()));
+        assert(encoding->EncodeOrdinaryInto(spanText, std::span<uint32_t>(roomy)) == spanAll.size());
+        assert(std::equal(spanAll.begin(), spanAll.end(), roomy.begin()));
+    }
+    std::vector<uint32_t> sunk;
+    std::size_t chunks = 0;
+    encoding->EncodeOrdinaryInto(largeText.substr(0, 65536), [&](std::span<const uint32_t> chunk)
+        {
+            chunks++;
+            sunk.insert(sunk.end(), chunk.begin(), chunk.end());
+        }, 1000);
+    assert(sunk == encoding->EncodeOrdinary(largeText.substr(0, 65536)));
+    assert((chunks > 0) && (chunks <= (sunk.size() + 999) / 1000));
+    sunk.clear();
+    encoding->EncodeOrdinaryInto(invalidText, [&](std::span<const uint32_t> chunk) { sunk.insert(sunk.end(), chunk.begin(), chunk.end()); }, 1);
+    assert(sunk == encoding->EncodeOrdinary(invalidText));
+
+    //encoding up to a budget gives the first whole pieces of the full tokens
+    for (const std::string& budgetText : { largeText.substr(0, 4096), text, "hello \xff world \xe4\xb8"s, wideUtf8 })
+    {
+        std::vector<uint32_t> all = encoding->EncodeOrdinary(budgetText);
+        for (std::size_t maxTokens : { 0, 1, 2, 3, 5, 100, 1000, 100000 })
+        {
+            TokenPrefix prefix = encoding->EncodeUpTo(budgetText, maxTokens);
+            assert(prefix.tokens.size() <= maxTokens);
+            assert(std::equal(prefix.tokens.begin(), prefix.tokens.end(), all.begin()));
+            assert(encoding->Decode(prefix.tokens) == budgetText.substr(0, prefix.bytes));
+            assert((all.size() > maxTokens) || (prefix.tokens == all));
+            assert(IsValidUtf8(encoding->PrefixUpTo(budgetText, maxTokens)));
+        }
+    }
+    Timer ut(true);
+    TokenPrefix budgetPrefix = encoding->EncodeUpTo(largeText, 4096);
+    std::cout << "EncodeUpTo time of 4096 tokens from " << largeText.size() << " bytes: " << ut.GetMS()
+        << ", " << budgetPrefix.bytes << " bytes taken" << std::endl;
+
+    //counting gives the size of the tokens without storing them
+    assert(encoding->CountTokensOrdinary("hello \xff world \xe4\xb8") == encoding->EncodeOrdinary("hello \xff world \xe4\xb8").size());
+    assert(encoding->CountTokens(wideUtf8, endOfText) == enc.size());
+    assert(encoding->CountTokens("hello <|endoftext|>", "all") == 3);
+    Timer ct(true);
+    std::size_t encodedCount = 0;
+    for (int round = 0; round < 5; round++)
+        encodedCount += encoding->EncodeOrdinary(largeText).size();
+    auto encodeCountTime = ct.GetMS();
+    ct.Start();
+    std::size_t countedCount = 0;
+    for (int round = 0; round < 5; round++)
+        countedCount += encoding->CountTokensOrdinary(largeText);
+    assert(countedCount == encodedCount);
+    std::cout << "Count time of " << encodedCount / 5 << " tokens (EncodeOrdinary().size()): " << encodeCountTime
+        << ", (CountTokensOrdinary): " << ct.GetMS() << std::endl;
+
     //Tokens symbol test
     text = "tiktoken is great!";
     std::cout << "Symbols test for: \"" << text << "\"" << std::endl;
@@ -176,4 +905,19 @@ int main()
     
     auto spantime = st.GetMS();
     std::cout << "Span time: " << spantime << ", " << rrr <<std::endl;
+
+    //decode into a reused caller buffer, no allocation per call
+    std::vector<char> decBuffer(4096);
+    std::size_t decLength = 0;
+    st.Start();
+    for (int round = 0; round < 1000; round++)
+    {
+        for (auto& token : dec_tokens)
+        {
+            decLength = encoding->DecodeInto(token, decBuffer);
+        }
+    }
+
+    spantime = st.GetMS();
+    std::cout << "Span time (DecodeInto): " << spantime << ", " << std::string_view(decBuffer.data(), decLength) << std::endl;
 }
@@ -0,0 +1,176 @@
+//build time generator of embedded encodings (cmake option EMBED_ENCODING_FILES).
+//usage: embed_encoding <encoding files dir> <output dir> <encoding name>...
+//writes embedded_<name>.cpp for every encoding and embedded_encodings.cpp listing them.
+//an encoding file identical to an earlier one gets no tables of its own, it points at the earlier ones
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <bit>
+#include <algorithm>
+#include "utils.h"
+#include "bpe_vocab.h"
+#include "vocab_file.h"
+
+using namespace TiktokenCpp;
+namespace stdfs = std::filesystem;
+
+template<typename T, typename Writer>
+static void WriteArray(std::ofstream& file, const char* decl, std::span<const T> items, std::size_t perLine, Writer writer)
+{
+    file << decl << " = {";
+    for (std::size_t i = 0; i < items.size(); i++)
+    {
+        if ((i % perLine) == 0)
+            file << "\n    ";
+        writer(file, items[i]);
+        file << ',';
+    }
+    if (items.empty())
+        file << "0"; //no zero sized arrays
+    file << "\n};\n\n";
+}
+
+//tables of an encoding written by this run, an encoding file identical to its source shares them
+struct WrittenTables
+{
+    std::string name;
+    VocabSource source;
+    std::size_t arenaSize;
+    std::size_t rankCount;
+    std::size_t tokenCount;
+    std::size_t displacementCount;
+};
+
+static std::ofstream CreateSource(const std::string& name, const stdfs::path& pathname)
+{
+    std::ofstream file(pathname, std::ios::out | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error("can not create " + pathname.string());
+
+    file << "//generated by tools/embed_encoding.cpp from " << name << ".tiktoken, do not edit\n";
+    return file;
+}
+
+//the tables have external linkage, so encodings of identical files can point at them
+static void WriteEncodingDefinition(std::ofstream& file, const std::string& name, const WrittenTables& tables)
+{
+    file << "extern const EmbeddedEncoding EMBEDDED_ENCODING_" << name << " = {\n"
+         << "    \"" << name << "\",\n"
+         << "    EMBEDDED_ARENA_" << tables.name << ", " << tables.arenaSize << ",\n"
+         << "    EMBEDDED_OFFSETS_" << tables.name << ", " << tables.rankCount << ",\n"
+         << "    EMBEDDED_SLOTS_" << tables.name << ", " << tables.tokenCount << ",\n"
+         << "    EMBEDDED_DISPLACEMENTS_" << tables.name << ", " << tables.displacementCount << "\n"
+         << "};\n}\n";
+}
+
+static WrittenTables WriteEncoding(const std::string& name, const VocabSource& source, const BpeVocab& vocab, const stdfs::path& pathname)
+{
+    std::ofstream file = CreateSource(name, pathname);
+    file << "#include <bit>\n#include \"embedded_encoding.h\"\n\n";
+    //packed token keys depend on the byte order of the generating host
+    file << "static_assert(std::endian::native == std::endian::"
+         << ((std::endian::native == std::endian::little) ? "little" : "big") << ", \"embedded tables are generated for another byte order\");\n\n";
+    file << "namespace TiktokenCpp\n{\n";
+
+    WriteArray(file, ("extern const uint8_t EMBEDDED_ARENA_" + name + "[]").c_str(), vocab.ArenaBytes(), 32,
+        [](std::ofstream& f, uint8_t v) { f << static_cast<unsigned>(v); });
+    WriteArray(file, ("extern const uint32_t EMBEDDED_OFFSETS_" + name + "[]").c_str(), vocab.RankOffsets(), 16,
+        [](std::ofstream& f, uint32_t v) { f << v; });
+    WriteArray(file, ("extern const VocabSlot EMBEDDED_SLOTS_" + name + "[]").c_str(), vocab.IndexSlots(), 4,
+        [](std::ofstream& f, const VocabSlot& v) { f << '{' << v.key << "ULL," << v.rank << ',' << v.length << '}'; });
+    WriteArray(file, ("extern const uint32_t EMBEDDED_DISPLACEMENTS_" + name + "[]").c_str(), vocab.Displacements(), 16,
+        [](std::ofstream& f, uint32_t v) { f << v; });
+
+    WrittenTables tables{ name, source, vocab.ArenaBytes().size(), vocab.RankCount(), vocab.Size(), vocab.Displacements().size() };
+    WriteEncodingDefinition(file, name, tables);
+    if (!file.flush())
+        throw std::runtime_error("fail to write " + pathname.string());
+
+    return tables;
+}
+
+//an encoding whose file is the same as an already written one, only its name differs
+static void WriteEncodingAlias(const std::string& name, const WrittenTables& tables, const stdfs::path& pathname)
+{
+    std::ofstream file = CreateSource(name, pathname);
+    file << "//" << name << ".tiktoken is identical to " << tables.name << ".tiktoken, the tables of " << tables.name << " are shared\n";
+    file << "#include \"embedded_encoding.h\"\n\n";
+    file << "namespace TiktokenCpp\n{\n";
+    file << "extern const uint8_t EMBEDDED_ARENA_" << tables.name << "[];\n"
+         << "extern const uint32_t EMBEDDED_OFFSETS_" << tables.name << "[];\n"
+         << "extern const VocabSlot EMBEDDED_SLOTS_" << tables.name << "[];\n"
+         << "extern const uint32_t EMBEDDED_DISPLACEMENTS_" << tables.name << "[];\n\n";
+    WriteEncodingDefinition(file, name, tables);
+    if (!file.flush())
+        throw std::runtime_error("fail to write " + pathname.string());
+}
+
+static void WriteEncodingList(const std::vector<std::string>& names, const stdfs::path& pathname)
+{
+    std::ofstream file(pathname, std::ios::out | std::ios::trunc);
+    if (!file)
+        throw std::runtime_error("can not create " + pathname.string());
+
+    file << "//generated by tools/embed_encoding.cpp, do not edit\n";
+    file << "#include \"embedded_encoding.h\"\n\n";
+    file << "namespace TiktokenCpp\n{\n";
+    for (const std::string& name : names)
+        file << "    extern const EmbeddedEncoding EMBEDDED_ENCODING_" << name << ";\n";
+    file << "\n    extern const EmbeddedEncoding* const EMBEDDED_ENCODINGS[] = {\n";
+    for (const std::string& name : names)
+        file << "        &EMBEDDED_ENCODING_" << name << ",\n";
+    file << "        nullptr\n    };\n";
+    file << "    extern const std::size_t EMBEDDED_ENCODING_COUNT = " << names.size() << ";\n}\n";
+    if (!file.flush())
+        throw std::runtime_error("fail to write " + pathname.string());
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: embed_encoding <encoding files dir> <output dir> <encoding name>..." << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        stdfs::path inputDir = argv[1];
+        stdfs::path outputDir = argv[2];
+        stdfs::create_directories(outputDir);
+
+        std::vector<std::string> names;
+        std::vector<WrittenTables> written;
+        for (int i = 3; i < argc; i++)
+        {
+            std::string name = argv[i];
+            std::string inputPathname = (inputDir / (name + ".tiktoken")).string();
+            std::optional<VocabSource> source = ReadVocabSource(inputPathname);
+            if (!source.has_value())
+                throw std::runtime_error("can not open token encoding file: " + inputPathname);
+
+            //same size and content hash: the same file under another name (p50k_edit and p50k_base)
+            auto same = std::find_if(written.begin(), written.end(), [&source](const WrittenTables& tables)
+                { return (tables.source.size == source->size) && (tables.source.hash == source->hash); });
+            if (same != written.end())
+            {
+                WriteEncodingAlias(name, *same, outputDir / ("embedded_" + name + ".cpp"));
+            }
+            else
+            {
+                std::unique_ptr<BpeVocab> vocab = LoadTiktokenBpe(inputPathname);
+                vocab->BuildPerfectIndex();
+                written.push_back(WriteEncoding(name, *source, *vocab, outputDir / ("embedded_" + name + ".cpp")));
+            }
+            names.push_back(name);
+        }
+        WriteEncodingList(names, outputDir / "embedded_encodings.cpp");
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "embed_encoding: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,753 @@
+//build time generator of split pattern DFAs (cmake option GENERATE_PATTERN_DFA).
+//usage: regex_dfa <output file> <encoding name>...
+//compiles the pat_str of every encoding into a PatternDfa (see pattern_dfa.h). patterns
+//using features outside the supported subset are skipped with a warning, PCRE2 is used
+//for them at runtime. supported: literals, ., [...] classes and ranges, \s \S \p{L} \p{N}
+//\P{L} \P{N} \r \n \t \f, (...) (?:...) (?i:...), | and greedy or lazy ? * + {m,n},
+//and one-character lookaheads (?=x) (?!x).
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <deque>
+#include <algorithm>
+#include "registry.h"
+#include "unicode_tables.h"
+#include "pattern_dfa.h"
+
+using namespace TiktokenCpp;
+
+//a symbol of the DFA alphabet: one code point the pattern names literally,
+//or (generic) every other code point of a class
+struct Symbol
+{
+    bool generic;
+    uint32_t cp;
+    CharClass cls;
+};
+
+using CharSet = std::function<bool(const Symbol&)>;
+
+struct RegexNode
+{
+    enum Type { Empty, Set, Concat, Alternate, Repeat, LookAhead } type = Empty;
+    CharSet set;
+    std::vector<RegexNode> children;
+    int min = 0;
+    int max = -1; //-1 for no limit
+    bool greedy = true;
+    bool negative = false;
+};
+
+static std::u32string DecodeUtf8(const std::string& text)
+{
+    std::u32string out;
+    for (std::size_t i = 0; i < text.size();)
+    {
+        uint8_t c = static_cast<uint8_t>(text[i]);
+        std::size_t length = (c < 0x80) ? 1 : (c < 0xE0) ? 2 : (c < 0xF0) ? 3 : 4;
+        if (i + length > text.size())
+            throw std::runtime_error("invalid UTF-8 in pattern");
+
+        uint32_t cp = (length == 1) ? c : (c & (0x7Fu >> length));
+        for (std::size_t k = 1; k < length; k++)
+            cp = (cp << 6) | (static_cast<uint8_t>(text[i + k]) & 0x3Fu);
+        out.push_back(cp);
+        i += length;
+    }
+
+    return out;
+}
+
+class RegexParser
+{
+public:
+    explicit RegexParser(const std::string& pattern) : m_pattern(DecodeUtf8(pattern)) {}
+
+    RegexNode Parse()
+    {
+        RegexNode node = ParseAlternation();
+        if (m_pos != m_pattern.size())
+            Fail("unbalanced )");
+
+        return node;
+    }
+
+    //code points named literally, each becomes a symbol of its own
+    const std::set<uint32_t>& Literals() const { return m_literals; }
+
+private:
+    [[noreturn]] void Fail(const std::string& reason) const
+    {
+        throw std::runtime_error(reason + " at offset " + std::to_string(m_pos));
+    }
+
+    bool AtEnd() const { return m_pos >= m_pattern.size(); }
+    char32_t Peek(std::size_t ahead = 0) const { return (m_pos + ahead < m_pattern.size()) ? m_pattern[m_pos + ahead] : 0; }
+
+    bool Accept(const std::u32string& text)
+    {
+        if (m_pattern.compare(m_pos, text.size(), text) != 0)
+            return false;
+        m_pos += text.size();
+        return true;
+    }
+
+    RegexNode ParseAlternation()
+    {
+        RegexNode alt;
+        alt.type = RegexNode::Alternate;
+        alt.children.push_back(ParseSequence());
+        while (!AtEnd() && (Peek() == U'|'))
+        {
+            m_pos++;
+            alt.children.push_back(ParseSequence());
+        }
+
+        return (alt.children.size() == 1) ? alt.children[0] : alt;
+    }
+
+    RegexNode ParseSequence()
+    {
+        RegexNode seq;
+        seq.type = RegexNode::Concat;
+        while (!AtEnd() && (Peek() != U'|') && (Peek() != U')'))
+        {
+            RegexNode atom = ParseAtom();
+            seq.children.push_back(ParseQuantifier(std::move(atom)));
+        }
+
+        return seq;
+    }
+
+    RegexNode ParseQuantifier(RegexNode atom)
+    {
+        while (!AtEnd())
+        {
+            int min = 0, max = -1;
+            char32_t c = Peek();
+            if (c == U'?')
+                max = 1;
+            else if (c == U'*')
+                ;
+            else if (c == U'+')
+                min = 1;
+            else if (c == U'{')
+            {
+                std::size_t close = m_pattern.find(U'}', m_pos);
+                if (close == std::u32string::npos)
+                    Fail("unsupported {");
+                std::string body(m_pattern.begin() + m_pos + 1, m_pattern.begin() + close);
+                if (body.empty() || (body.find_first_not_of("0123456789,") != std::string::npos))
+                    Fail("unsupported {");
+                std::size_t comma = body.find(',');
+                min = std::stoi(body.substr(0, comma));
+                max = (comma == std::string::npos) ? min : ((comma + 1 < body.size()) ? std::stoi(body.substr(comma + 1)) : -1);
+                m_pos = close;
+            }
+            else
+                break;
+            m_pos++;
+
+            if (atom.type == RegexNode::LookAhead)
+                Fail("quantified lookahead");
+            RegexNode repeat;
+            repeat.type = RegexNode::Repeat;
+            repeat.min = min;
+            repeat.max = max;
+            if (!AtEnd() && (Peek() == U'?'))
+            {
+                repeat.greedy = false;
+                m_pos++;
+            }
+            else if (!AtEnd() && (Peek() == U'+'))
+                Fail("possessive quantifier");
+            repeat.children.push_back(std::move(atom));
+            atom = std::move(repeat);
+        }
+
+        return atom;
+    }
+
+    RegexNode ParseAtom()
+    {
+        char32_t c = Peek();
+        if (c == U'(')
+            return ParseGroup();
+        if (c == U'[')
+            return MakeSet(ParseClass());
+        if (c == U'.')
+        {
+            m_pos++;
+            m_literals.insert(U'\n');
+            return MakeSet([](const Symbol& s) { return s.generic || (s.cp != U'\n'); });
+        }
+        if (c == U'\\')
+        {
+            m_pos++;
+            return MakeSet(ParseEscape(false));
+        }
+        if ((c == U'^') || (c == U'$'))
+            Fail("anchors");
+        if ((c == U'*') || (c == U'+') || (c == U'?') || (c == U'{'))
+            Fail("quantifier without atom");
+
+        m_pos++;
+        return MakeSet(Literal(c));
+    }
+
+    RegexNode ParseGroup()
+    {
+        m_pos++; //(
+        bool caseless = m_caseless;
+        RegexNode node;
+        if (Accept(U"?:"))
+            node = ParseAlternation();
+        else if (Accept(U"?i:"))
+        {
+            m_caseless = true;
+            node = ParseAlternation();
+        }
+        else if (Accept(U"?=") || Accept(U"?!"))
+        {
+            bool negative = (m_pattern[m_pos - 1] == U'!');
+            RegexNode inner = ParseAlternation();
+            if ((inner.type == RegexNode::Concat) && (inner.children.size() == 1))
+                inner = inner.children[0];
+            if (inner.type != RegexNode::Set)
+                Fail("lookahead longer than one character");
+            node.type = RegexNode::LookAhead;
+            node.set = inner.set;
+            node.negative = negative;
+        }
+        else if (Peek() == U'?')
+            Fail("unsupported group");
+        else
+            node = ParseAlternation(); //captures do not matter for splitting
+
+        m_caseless = caseless;
+        if (AtEnd() || (Peek() != U')'))
+            Fail("missing )");
+        m_pos++;
+
+        return node;
+    }
+
+    CharSet ParseClass()
+    {
+        m_pos++; //[
+        bool negate = false;
+        if (!AtEnd() && (Peek() == U'^'))
+        {
+            negate = true;
+            m_pos++;
+        }
+
+        std::vector<CharSet> items;
+        bool first = true;
+        while (true)
+        {
+            if (AtEnd())
+                Fail("missing ]");
+            char32_t c = Peek();
+            if ((c == U']') && !first)
+                break;
+            first = false;
+            if ((c == U'[') && (Peek(1) == U':'))
+                Fail("posix class");
+
+            if (c == U'\\')
+            {
+                m_pos++;
+                char32_t e = Peek();
+                if ((e == U's') || (e == U'S') || (e == U'p') || (e == U'P'))
+                {
+                    items.push_back(ParseEscape(true));
+                    continue;
+                }
+                c = ParseEscapedLiteral();
+            }
+            else
+                m_pos++;
+
+            if ((Peek() == U'-') && (Peek(1) != U']') && (Peek(1) != 0))
+            {
+                m_pos++;
+                char32_t last = Peek();
+                m_pos++;
+                if (last == U'\\')
+                    last = ParseEscapedLiteral();
+                if ((last < c) || (last - c > 256))
+                    Fail("unsupported range");
+                for (char32_t r = c; r <= last; r++)
+                    items.push_back(Literal(r));
+            }
+            else
+                items.push_back(Literal(c));
+        }
+        m_pos++; //]
+
+        return [items, negate](const Symbol& s)
+        {
+            bool in = std::any_of(items.begin(), items.end(), [&s](const CharSet& item) { return item(s); });
+            return in != negate;
+        };
+    }
+
+    //escape after the backslash
+    CharSet ParseEscape(bool inClass)
+    {
+        char32_t e = Peek();
+        if ((e == U's') || (e == U'S'))
+        {
+            m_pos++;
+            bool negate = (e == U'S');
+            return [negate](const Symbol& s) { return (s.cls == CharClass::Space) != negate; };
+        }
+        if ((e == U'p') || (e == U'P'))
+        {
+            m_pos++;
+            bool negate = (e == U'P');
+            CharClass cls = CharClass::Other;
+            if (Accept(U"{L}"))
+                cls = CharClass::Letter;
+            else if (Accept(U"{N}"))
+                cls = CharClass::Number;
+            else
+                Fail("unsupported property");
+            return [negate, cls](const Symbol& s) { return (s.cls == cls) != negate; };
+        }
+
+        return Literal(ParseEscapedLiteral());
+    }
+
+    char32_t ParseEscapedLiteral()
+    {
+        char32_t e = Peek();
+        m_pos++;
+        switch (e)
+        {
+        case U'r': return U'\r';
+        case U'n': return U'\n';
+        case U't': return U'\t';
+        case U'f': return U'\f';
+        default:
+            if ((e < 0x80) && std::isalnum(static_cast<int>(e)))
+                Fail("unsupported escape");
+            return e;
+        }
+    }
+
+    //set of one literal code point and, in caseless groups, the code points PCRE2 folds onto it
+    CharSet Literal(char32_t c)
+    {
+        std::set<uint32_t> variants{ static_cast<uint32_t>(c) };
+        if (m_caseless)
+        {
+            if (c >= 0x80)
+            {
+                if (GetCharClass(c) == CharClass::Letter)
+                    Fail("caseless non-ASCII letter");
+            }
+            else if (std::isalpha(static_cast<int>(c)))
+            {
+                char32_t lower = c | 0x20;
+                variants.insert(lower);
+                variants.insert(lower & ~0x20u);
+                if (lower == U's')
+                    variants.insert(0x17F); //long s
+                if (lower == U'k')
+                    variants.insert(0x212A); //kelvin sign
+            }
+        }
+
+        m_literals.insert(variants.begin(), variants.end());
+        return [variants](const Symbol& s) { return !s.generic && variants.contains(s.cp); };
+    }
+
+    static RegexNode MakeSet(CharSet set)
+    {
+        RegexNode node;
+        node.type = RegexNode::Set;
+        node.set = std::move(set);
+        return node;
+    }
+
+    std::u32string m_pattern;
+    std::size_t m_pos = 0;
+    bool m_caseless = false;
+    std::set<uint32_t> m_literals;
+};
+
+struct NfaNode
+{
+    enum Type { Char, Split, Jump, Assert, Match } type = Match;
+    std::vector<bool> accepts; //Char and Assert, by symbol (end of text excluded)
+    bool negative = false;
+    int out1 = -1; //preferred branch of a Split
+    int out2 = -1;
+};
+
+class NfaBuilder
+{
+public:
+    explicit NfaBuilder(const std::vector<Symbol>& symbols) : m_symbols(symbols) {}
+
+    int Build(const RegexNode& node, int next)
+    {
+        switch (node.type)
+        {
+        case RegexNode::Empty:
+            return next;
+        case RegexNode::Set:
+        {
+            int id = Add(NfaNode::Char, next);
+            m_nodes[id].accepts = Evaluate(node.set);
+            return id;
+        }
+        case RegexNode::LookAhead:
+        {
+            int id = Add(NfaNode::Assert, next);
+            m_nodes[id].accepts = Evaluate(node.set);
+            m_nodes[id].negative = node.negative;
+            return id;
+        }
+        case RegexNode::Concat:
+            for (auto it = node.children.rbegin(); it != node.children.rend(); ++it)
+                next = Build(*it, next);
+            return next;
+        case RegexNode::Alternate:
+        {
+            int entry = Build(node.children.back(), next);
+            for (std::size_t i = node.children.size() - 1; i-- > 0;)
+            {
+                int branch = Build(node.children[i], next);
+                entry = AddSplit(branch, entry);
+            }
+            return entry;
+        }
+        case RegexNode::Repeat:
+        {
+            const RegexNode& child = node.children[0];
+            int entry = next;
+            if (node.max < 0)
+            {
+                int loop = Add(NfaNode::Split, -1);
+                int body = Build(child, loop);
+                m_nodes[loop].out1 = node.greedy ? body : next;
+                m_nodes[loop].out2 = node.greedy ? next : body;
+                entry = loop;
+            }
+            else
+            {
+                for (int i = node.min; i < node.max; i++)
+                {
+                    int body = Build(child, entry);
+                    entry = node.greedy ? AddSplit(body, next) : AddSplit(next, body);
+                }
+            }
+            for (int i = 0; i < node.min; i++)
+                entry = Build(child, entry);
+            return entry;
+        }
+        }
+
+        return next;
+    }
+
+    int AddMatch() { return Add(NfaNode::Match, -1); }
+    const std::vector<NfaNode>& Nodes() const { return m_nodes; }
+
+private:
+    int Add(NfaNode::Type type, int out)
+    {
+        NfaNode node;
+        node.type = type;
+        node.out1 = out;
+        m_nodes.push_back(node);
+        return static_cast<int>(m_nodes.size() - 1);
+    }
+
+    int AddSplit(int preferred, int other)
+    {
+        int id = Add(NfaNode::Split, preferred);
+        m_nodes[id].out2 = other;
+        return id;
+    }
+
+    std::vector<bool> Evaluate(const CharSet& set) const
+    {
+        std::vector<bool> accepts(m_symbols.size());
+        for (std::size_t i = 0; i < m_symbols.size(); i++)
+            accepts[i] = set(m_symbols[i]);
+        return accepts;
+    }
+
+    const std::vector<Symbol>& m_symbols;
+    std::vector<NfaNode> m_nodes;
+};
+
+//leftmost-first subset construction. a DFA state is the ordered list of NFA threads waiting
+//for the next symbol, in PCRE2's backtracking priority. the epsilon closure is taken when the
+//next symbol is known, so lookaheads see it; when the closure reaches Match, the match is
+//flagged on the transition and all lower priority threads are dropped.
+class DfaBuilder
+{
+public:
+    DfaBuilder(const std::vector<NfaNode>& nfa, std::size_t symbolCount) : m_nfa(nfa), m_symbolCount(symbolCount) {}
+
+    void Build(int start)
+    {
+        StateOf({}); //dead state
+        StateOf({ start });
+        for (std::size_t state = 1; state < m_kernels.size(); state++)
+        {
+            for (std::size_t symbol = 0; symbol <= m_symbolCount; symbol++) //last one is the end of text
+            {
+                bool matched = false;
+                std::vector<int> next = Step(m_kernels[state], symbol, matched);
+                if ((state == PATTERN_DFA_START_STATE) && matched)
+                    throw std::runtime_error("pattern can match the empty string");
+
+                uint16_t target = StateOf(next);
+                m_transitions.push_back(target | (matched ? PATTERN_DFA_MATCH : 0));
+            }
+        }
+    }
+
+    std::size_t StateCount() const { return m_kernels.size(); }
+    const std::vector<uint16_t>& Transitions() const { return m_transitions; } //without the dead state row
+
+private:
+    uint16_t StateOf(const std::vector<int>& kernel)
+    {
+        auto it = m_ids.find(kernel);
+        if (it != m_ids.end())
+            return it->second;
+        if (m_kernels.size() >= PATTERN_DFA_MATCH)
+            throw std::runtime_error("too many DFA states");
+
+        uint16_t id = static_cast<uint16_t>(m_kernels.size());
+        m_ids.emplace(kernel, id);
+        m_kernels.push_back(kernel);
+        return id;
+    }
+
+    std::vector<int> Step(const std::vector<int>& kernel, std::size_t symbol, bool& matched) const
+    {
+        std::vector<char> visited(m_nfa.size(), 0);
+        std::vector<int> waiting;
+        bool stop = false;
+        std::function<void(int)> visit = [&](int id)
+        {
+            if (stop || visited[id])
+                return;
+            visited[id] = 1;
+
+            const NfaNode& node = m_nfa[id];
+            switch (node.type)
+            {
+            case NfaNode::Char:
+                waiting.push_back(id);
+                break;
+            case NfaNode::Split:
+                visit(node.out1);
+                visit(node.out2);
+                break;
+            case NfaNode::Jump:
+                visit(node.out1);
+                break;
+            case NfaNode::Assert:
+            {
+                bool in = (symbol < m_symbolCount) && node.accepts[symbol];
+                if (in != node.negative)
+                    visit(node.out1);
+                break;
+            }
+            case NfaNode::Match:
+                matched = true;
+                stop = true;
+                break;
+            }
+        };
+        for (int id : kernel)
+        {
+            visit(id);
+            if (stop)
+                break;
+        }
+
+        std::vector<int> next;
+        if (symbol >= m_symbolCount)
+            return next;
+        for (int id : waiting)
+        {
+            int out = m_nfa[id].out1;
+            if (m_nfa[id].accepts[symbol] && (std::find(next.begin(), next.end(), out) == next.end()))
+                next.push_back(out);
+        }
+
+        return next;
+    }
+
+    const std::vector<NfaNode>& m_nfa;
+    std::size_t m_symbolCount;
+    std::map<std::vector<int>, uint16_t> m_ids;
+    std::vector<std::vector<int>> m_kernels;
+    std::vector<uint16_t> m_transitions;
+};
+
+static std::string CString(const std::string& text)
+{
+    std::ostringstream out;
+    out << '"';
+    for (unsigned char c : text)
+    {
+        if ((c == '\\') || (c == '"') || (c == '?'))
+            out << '\\' << c;
+        else if ((c >= 0x20) && (c < 0x7F))
+            out << c;
+        else
+        {
+            const char* digits = "01234567";
+            out << '\\' << digits[(c >> 6) & 7] << digits[(c >> 3) & 7] << digits[c & 7];
+        }
+    }
+    out << '"';
+    return out.str();
+}
+
+template<typename T>
+static void WriteArray(std::ostream& out, const std::string& decl, const std::vector<T>& items, std::size_t perLine)
+{
+    out << "    " << decl << " = {";
+    for (std::size_t i = 0; i < items.size(); i++)
+        out << ((i % perLine) ? "" : "\n        ") << static_cast<uint64_t>(items[i]) << ',';
+    if (items.empty())
+        out << "0"; //no zero sized arrays
+    out << "\n    };\n";
+}
+
+//compile one pattern, write its tables and return the definition of its PatternDfa
+static void WriteDfa(std::ostream& out, const std::string& pattern, const std::string& id)
+{
+    RegexParser parser(pattern);
+    RegexNode root = parser.Parse();
+
+    const std::vector<uint32_t> literals(parser.Literals().begin(), parser.Literals().end());
+    std::vector<Symbol> symbols;
+    for (uint32_t cp : literals)
+        symbols.push_back({ false, cp, GetCharClass(cp) });
+    for (uint8_t cls = 0; cls < 4; cls++)
+        symbols.push_back({ true, 0, static_cast<CharClass>(cls) });
+    if (symbols.size() + 1 > 255)
+        throw std::runtime_error("too many literal code points");
+
+    NfaBuilder nfa(symbols);
+    int start = nfa.Build(root, nfa.AddMatch());
+    DfaBuilder dfa(nfa.Nodes(), symbols.size());
+    dfa.Build(start);
+
+    auto symbolOf = [&](uint32_t cp) -> uint8_t
+    {
+        auto it = std::find(literals.begin(), literals.end(), cp);
+        if (it != literals.end())
+            return static_cast<uint8_t>(it - literals.begin());
+        return static_cast<uint8_t>(literals.size() + static_cast<uint8_t>(GetCharClass(cp)));
+    };
+    std::vector<uint8_t> ascii(128), classes(4), extraSymbols;
+    std::vector<uint32_t> extraCodePoints;
+    for (uint32_t cp = 0; cp < 128; cp++)
+        ascii[cp] = symbolOf(cp);
+    for (uint8_t cls = 0; cls < 4; cls++)
+        classes[cls] = static_cast<uint8_t>(literals.size() + cls);
+    for (uint32_t cp : literals)
+    {
+        if (cp >= 0x80)
+        {
+            extraCodePoints.push_back(cp);
+            extraSymbols.push_back(symbolOf(cp));
+        }
+    }
+
+    const std::size_t symbolCount = symbols.size() + 1;
+    std::vector<uint16_t> transitions(symbolCount, PATTERN_DFA_DEAD_STATE); //dead state row
+    transitions.insert(transitions.end(), dfa.Transitions().begin(), dfa.Transitions().end());
+
+    out << "    //" << pattern << "\n";
+    out << "    //" << dfa.StateCount() << " states, " << symbolCount << " symbols\n";
+    WriteArray(out, "static const uint8_t " + id + "_ASCII_SYMBOLS[128]", ascii, 32);
+    WriteArray(out, "static const uint8_t " + id + "_CLASS_SYMBOLS[4]", classes, 4);
+    WriteArray(out, "static const uint32_t " + id + "_EXTRA_CODE_POINTS[]", extraCodePoints, 8);
+    WriteArray(out, "static const uint8_t " + id + "_EXTRA_SYMBOLS[]", extraSymbols, 8);
+    WriteArray(out, "static const uint16_t " + id + "_TRANSITIONS[]", transitions, symbolCount);
+    out << "    static const PatternDfa " << id << " = {\n"
+        << "        " << CString(pattern) << ",\n"
+        << "        " << dfa.StateCount() << ", " << symbolCount << ",\n"
+        << "        " << id << "_ASCII_SYMBOLS, " << id << "_CLASS_SYMBOLS,\n"
+        << "        " << id << "_EXTRA_CODE_POINTS, " << id << "_EXTRA_SYMBOLS, " << extraCodePoints.size() << ",\n"
+        << "        " << id << "_TRANSITIONS\n"
+        << "    };\n\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: regex_dfa <output file> <encoding name>..." << std::endl;
+        return 1;
+    }
+
+    try
+    {
+        std::set<std::string> patterns;
+        for (int i = 2; i < argc; i++)
+            patterns.insert(std::string(Registry::GetEncodingParam(argv[i]).pat_str));
+
+        std::ostringstream body;
+        std::vector<std::string> ids;
+        for (const std::string& pattern : patterns)
+        {
+            std::string id = "DFA" + std::to_string(ids.size());
+            std::ostringstream tables;
+            try
+            {
+                WriteDfa(tables, pattern, id);
+            }
+            catch (const std::runtime_error& e)
+            {
+                std::cerr << "regex_dfa: warning: " << e.what() << ", PCRE2 is used for pattern " << pattern << std::endl;
+                continue;
+            }
+            body << tables.str();
+            ids.push_back(id);
+        }
+
+        std::ofstream file(argv[1], std::ios::out | std::ios::trunc);
+        if (!file)
+            throw std::runtime_error(std::string("can not create ") + argv[1]);
+
+        file << "//generated by tools/regex_dfa.cpp, do not edit\n";
+        file << "#include \"pattern_dfa.h\"\n\nnamespace TiktokenCpp\n{\n";
+        file << body.str();
+        file << "    extern const PatternDfa* const PATTERN_DFAS[] = {\n";
+        for (const std::string& id : ids)
+            file << "        &" << id << ",\n";
+        file << "        nullptr\n    };\n";
+        file << "    extern const std::size_t PATTERN_DFA_COUNT = " << ids.size() << ";\n}\n";
+        if (!file.flush())
+            throw std::runtime_error(std::string("fail to write ") + argv[1]);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "regex_dfa: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
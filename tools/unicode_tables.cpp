@@ -0,0 +1,82 @@
+//generator of tiktoken/src/unicode_tables.cpp, not part of the regular build.
+//classifies every code point with PCRE2 itself, so the hand-written pretokenizers
+//split exactly like the patterns compiled with PCRE2_UTF | PCRE2_UCP:
+//  g++ -std=c++20 tools/unicode_tables.cpp -lpcre2-32 -o unicode_tables
+//  ./unicode_tables > tiktoken/src/unicode_tables.cpp
+#define PCRE2_CODE_UNIT_WIDTH 32
+#include <pcre2.h>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+
+static pcre2_code* Compile(const std::u32string& pattern)
+{
+    int errorCode = 0;
+    PCRE2_SIZE errorOffset = 0;
+    return pcre2_compile(reinterpret_cast<PCRE2_SPTR>(pattern.data()), pattern.size(), PCRE2_UTF | PCRE2_UCP,
+                         &errorCode, &errorOffset, nullptr);
+}
+
+int main()
+{
+    //same order as CharClass in unicode_tables.h
+    pcre2_code* classes[] = { Compile(U"\\p{L}"), Compile(U"\\p{N}"), Compile(U"\\s") };
+    pcre2_match_data* matchData = pcre2_match_data_create(1, nullptr);
+
+    const uint32_t codePoints = 0x110000;
+    std::vector<uint8_t> table(codePoints, 0);
+    for (uint32_t cp = 0; cp < codePoints; cp++)
+    {
+        if ((cp >= 0xD800) && (cp < 0xE000))
+            continue; //surrogates never appear in valid UTF-8
+
+        for (uint8_t i = 0; i < 3; i++)
+        {
+            if (pcre2_match(classes[i], reinterpret_cast<PCRE2_SPTR>(&cp), 1, 0, PCRE2_ANCHORED, matchData, nullptr) >= 0)
+                table[cp] = i + 1;
+        }
+    }
+
+    //stage 2: unique blocks of 256 code points, 2 bits per code point
+    std::map<std::vector<uint8_t>, uint32_t> blockIds;
+    std::vector<std::vector<uint8_t>> blocks;
+    std::vector<uint32_t> stage1;
+    for (uint32_t base = 0; base < codePoints; base += 256)
+    {
+        std::vector<uint8_t> packed(64, 0);
+        for (uint32_t i = 0; i < 256; i++)
+            packed[i / 4] |= table[base + i] << ((i % 4) * 2);
+
+        auto it = blockIds.find(packed);
+        if (it == blockIds.end())
+        {
+            it = blockIds.emplace(packed, static_cast<uint32_t>(blocks.size())).first;
+            blocks.push_back(packed);
+        }
+        stage1.push_back(it->second);
+    }
+    if (blocks.size() > 256)
+    {
+        std::fprintf(stderr, "too many blocks for uint8_t stage 1 table\n");
+        return 1;
+    }
+
+    std::printf("//generated by tools/unicode_tables.cpp from PCRE2 %d.%d (Unicode property tables), do not edit\n",
+                PCRE2_MAJOR, PCRE2_MINOR);
+    std::printf("#include \"unicode_tables.h\"\n\nnamespace TiktokenCpp\n{\n");
+    std::printf("    const uint8_t UNICODE_CLASS_STAGE1[%zu] = {", stage1.size());
+    for (std::size_t i = 0; i < stage1.size(); i++)
+        std::printf("%s%u,", (i % 32) ? "" : "\n        ", stage1[i]);
+    std::printf("\n    };\n\n");
+    std::printf("    const uint8_t UNICODE_CLASS_STAGE2[%zu] = {", blocks.size() * 64);
+    for (std::size_t b = 0; b < blocks.size(); b++)
+    {
+        for (std::size_t i = 0; i < 64; i++)
+            std::printf("%s%u,", (i % 32) ? "" : "\n        ", blocks[b][i]);
+    }
+    std::printf("\n    };\n}\n");
+
+    return 0;
+}